@@ -37,7 +37,19 @@ void setup()
 
   // Just because we can, let's reset the MAX17048
   Serial.println(F("Resetting the MAX17048..."));
-  delay(1000); // Give it time to get its act back together
+  sfe_max1704x_reset_timing_t timing;
+  if (lipo.resetAndWait(&timing) == 0) // Wait only as long as it takes to get its act back together
+  {
+    Serial.print(F("Reset took "));
+    Serial.print(timing.totalMicros / 1000);
+    Serial.print(F("ms (reappeared after "));
+    Serial.print(timing.reappearMicros / 1000);
+    Serial.print(F("ms, first reading after a further "));
+    Serial.print(timing.readyMicros / 1000);
+    Serial.println(F("ms)"));
+  }
+  else
+    Serial.println(F("Reset timed out!"));
 
   // Read and print the reset indicator
   Serial.print(F("Reset Indicator was: "));
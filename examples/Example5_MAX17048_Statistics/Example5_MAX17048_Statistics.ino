@@ -0,0 +1,86 @@
+/******************************************************************************
+Example5_MAX17048_Statistics
+By: SparkFun Electronics
+Date: October 16th 2026
+
+This example reads a snapshot of the MAX17048 (VCELL, SOC, CRATE, ...) in a
+single I2C transaction and keeps sliding-window statistics of the raw values.
+
+It also measures how long each SFE_MAX1704X_SnapshotStats.add() takes, so you
+can see the cost of the statistics on your board.
+
+This code is released under the MIT license.
+
+Distributed as-is; no warranty is given.
+******************************************************************************/
+
+#include <Wire.h> // Needed for I2C
+
+#include <SparkFun_MAX1704x_Fuel_Gauge_Arduino_Library.h> // Click here to get the library: http://librarymanager/All#SparkFun_MAX1704x_Fuel_Gauge_Arduino_Library
+
+SFE_MAX1704X lipo(MAX1704X_MAX17048); // Create a MAX17048
+
+SFE_MAX1704X_SnapshotStats<32> stats; // Statistics over the last 32 samples
+
+void setup()
+{
+  Serial.begin(115200); // Start serial, to output debug data
+  while (!Serial)
+    ; //Wait for user to open terminal
+  Serial.println(F("MAX17048 Statistics Example"));
+
+  Wire.begin();
+
+  lipo.enableDebugging(); // Uncomment this line to enable helpful debug messages on Serial
+
+  // Set up the MAX17048 LiPo fuel gauge:
+  if (lipo.begin() == false) // Connect to the MAX17048 using the default wire port
+  {
+    Serial.println(F("MAX17048 not detected. Please check wiring. Freezing."));
+    while (1)
+      ;
+  }
+}
+
+void loop()
+{
+  sfe_max1704x_snapshot_t snapshot;
+
+  if (lipo.getSnapshot(snapshot) == 0) // Read everything in one transaction
+  {
+    unsigned long start = micros();
+    stats.add(snapshot); // Update the statistics
+    unsigned long addTime = micros() - start;
+
+    // Convert the raw values back into Volts and percent for printing
+    Serial.print(F("Voltage: "));
+    Serial.print(SFE_MAX1704X::convertVoltage(snapshot.vcell, snapshot.device), 3);
+    Serial.print(F("V (min "));
+    Serial.print(SFE_MAX1704X::convertVoltage(stats.vcell.minimum(), snapshot.device), 3);
+    Serial.print(F(" max "));
+    Serial.print(SFE_MAX1704X::convertVoltage(stats.vcell.maximum(), snapshot.device), 3);
+    Serial.print(F(")"));
+
+    Serial.print(F(" SOC: "));
+    Serial.print(SFE_MAX1704X::convertSOC(snapshot.soc), 2);
+    Serial.print(F("% (mean "));
+    Serial.print(stats.soc.mean() / 256.0, 2); // 1/256% per LSb
+    Serial.print(F("%)"));
+
+    Serial.print(F(" Change Rate: "));
+    Serial.print(SFE_MAX1704X::convertChangeRate(snapshot.crate), 2);
+    Serial.print(F("%/hr (std dev "));
+    Serial.print(sqrt(stats.crate.variance()) * 0.208, 3); // 0.208%/hr per LSb
+    Serial.print(F(")"));
+
+    Serial.print(F(" add() took "));
+    Serial.print(addTime);
+    Serial.println(F("us"));
+  }
+  else
+  {
+    Serial.println(F("getSnapshot failed!"));
+  }
+
+  delay(500);
+}
@@ -0,0 +1,102 @@
+/******************************************************************************
+Example6_MAX17048_AlertQueue
+By: SparkFun Electronics
+Date: October 16th 2026
+
+This example uses the MAX17048's ALRT pin instead of polling the gauge.
+
+Alert tracking programs a voltage window around the present battery voltage
+and enables the 1% SOC change alert. An interrupt captures each ALRT falling
+edge into a queue. The loop services a whole burst of edges with a single
+I2C read, which also re-centers the voltage window ready for the next alert.
+
+Connect the gauge's ALRT pin to ALRT_PIN. ALRT is open-drain: the pin's
+internal pull-up is enabled.
+
+This code is released under the MIT license.
+
+Distributed as-is; no warranty is given.
+******************************************************************************/
+
+#include <Wire.h> // Needed for I2C
+
+#include <SparkFun_MAX1704x_Fuel_Gauge_Arduino_Library.h> // Click here to get the library: http://librarymanager/All#SparkFun_MAX1704x_Fuel_Gauge_Arduino_Library
+
+SFE_MAX1704X lipo(MAX1704X_MAX17048); // Create a MAX17048
+
+#define ALRT_PIN 2 // Change this to match your wiring. It must support interrupts
+
+SFE_MAX1704X_AlertQueue<8> alerts; // Up to 7 edges can be queued
+
+void alertISR()
+{
+  alerts.capture(); // Timestamp the edge. Nothing else to do in the ISR
+}
+
+void setup()
+{
+  Serial.begin(115200); // Start serial, to output debug data
+  while (!Serial)
+    ; //Wait for user to open terminal
+  Serial.println(F("MAX17048 Alert Queue Example"));
+
+  Wire.begin();
+
+  lipo.enableDebugging(); // Uncomment this line to enable helpful debug messages on Serial
+
+  // Set up the MAX17048 LiPo fuel gauge:
+  if (lipo.begin() == false) // Connect to the MAX17048 using the default wire port
+  {
+    Serial.println(F("MAX17048 not detected. Please check wiring. Freezing."));
+    while (1)
+      ;
+  }
+
+  // Alert when VCELL moves 3 x 20mV = 60mV from where it is now, when SOC
+  // changes by 1%, or when SOC falls below 10%
+  if (lipo.enableAlertTracking(3, 10) != 0)
+  {
+    Serial.println(F("enableAlertTracking failed. Freezing."));
+    while (1)
+      ;
+  }
+
+  pinMode(ALRT_PIN, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(ALRT_PIN), alertISR, FALLING);
+}
+
+void loop()
+{
+  if (alerts.available()) // Has ALRT fired?
+  {
+    sfe_max1704x_alert_event_t event;
+
+    uint8_t status = lipo.serviceAlerts(alerts, &event); // Service every queued edge with one read
+
+    Serial.print(F("Alert! Edges: "));
+    Serial.print(event.edges);
+    Serial.print(F(" Latency: "));
+    Serial.print(event.latencyMicros);
+    Serial.print(F("us"));
+
+    if (status & MAX1704x_STATUS_VH)
+      Serial.print(F(" Voltage High"));
+    if (status & MAX1704x_STATUS_VL)
+      Serial.print(F(" Voltage Low"));
+    if (status & MAX1704x_STATUS_HD)
+      Serial.print(F(" SOC Low"));
+    if (status & MAX1704x_STATUS_SC)
+      Serial.print(F(" SOC Changed"));
+    if (event.result)
+      Serial.print(F(" (servicing failed!)"));
+    Serial.println();
+
+    Serial.print(F("Voltage: "));
+    Serial.print(lipo.getVoltage(), 3);
+    Serial.print(F("V Percentage: "));
+    Serial.print(lipo.getSOC(), 2);
+    Serial.println(F("%"));
+  }
+
+  // The host could sleep here until the next interrupt
+}
@@ -20,51 +20,126 @@ Distributed as-is; no warranty is given.
 ******************************************************************************/
 #include "SparkFun_MAX1704x_Fuel_Gauge_Arduino_Library.h"
 
+// Index of a register within the register block
+#define REGISTER_BLOCK_INDEX(reg) (((reg) - MAX1704X_REGISTER_BLOCK_START) >> 1)
+
 SFE_MAX1704X::SFE_MAX1704X(sfe_max1704x_devices_e device)
 {
   // Constructor
 
   // Record the device type
   _device = device;
+}
 
+float SFE_MAX1704X::getFullScale(sfe_max1704x_devices_e device)
+{
   // Define the full-scale voltage for VCELL based on the device
   switch (device)
   {
     case MAX1704X_MAX17044:
-      _full_scale = 10.24; // MAX17044 VCELL is 12-bit, 2.50mV per LSB
-      break;
+      return (10.24); // MAX17044 VCELL is 12-bit, 2.50mV per LSB
     case MAX1704X_MAX17048:
-      _full_scale = 5.12; // MAX17048 VCELL is 16-bit, 78.125uV/cell per LSB
-      break;
+      return (5.12); // MAX17048 VCELL is 16-bit, 78.125uV/cell per LSB
     case MAX1704X_MAX17049:
-      _full_scale = 10.24; // MAX17049 VCELL is 16-bit, 78.125uV/cell per LSB (i.e. 156.25uV per LSB)
-      break;
+      return (10.24); // MAX17049 VCELL is 16-bit, 78.125uV/cell per LSB (i.e. 156.25uV per LSB)
     default: // Default is the MAX17043
-      _full_scale = 5.12; // MAX17043 VCELL is 12-bit, 1.25mV per LSB
-      break;
+      return (5.12); // MAX17043 VCELL is 12-bit, 1.25mV per LSB
   }
 }
 
-boolean SFE_MAX1704X::begin(TwoWire &wirePort)
+boolean SFE_MAX1704X::begin(TwoWire &wirePort, boolean autoDetect)
 {
   _i2cPort = &wirePort; //Grab which port the user wants us to use
 
-  if (isConnected() == false)
+  if (probe() == false)
   {
     if (_printDebug == true)
     {
-      _debugPort->println(F("begin: isConnected returned false"));
+      _debugPort->println(F("begin: probe returned false"));
     }
     return (false);
   }
 
+  if (autoDetect)
+    detectDevice();
+
   return (true);
 }
 
+// The registers read by detectDevice: VERSION (0x08) to STATUS (0x1A)
+#define MAX1704X_DETECT_LENGTH 10
+#define DETECT_INDEX(reg) (((reg) - MAX17043_VERSION) >> 1)
+
+sfe_max1704x_devices_e SFE_MAX1704X::detectDevice()
+{
+  if (_deviceDetected)
+    return ((sfe_max1704x_devices_e)_device);
+
+  // VERSION and every MAX17048/49-only register, in a single burst read
+  uint16_t regs[MAX1704X_DETECT_LENGTH]; // VERSION .. STATUS
+  if (readRegisters(MAX17043_VERSION, regs, MAX1704X_DETECT_LENGTH) > 0)
+  {
+    if (_printDebug == true)
+    {
+      _debugPort->println(F("detectDevice: read failed"));
+    }
+    return ((sfe_max1704x_devices_e)_device); // Try again next time
+  }
+
+  // VERSION is the primary discriminator: the MAX17048/49 always report
+  // 0x001_. Anything else (e.g. 0x0003) is a MAX17043/44.
+  boolean is17048 = ((regs[DETECT_INDEX(MAX17043_VERSION)] & 0xFFF0) == 0x0010);
+
+  // Later MAX17043/44 silicon also reports 0x001_, so VERSION alone can not
+  // confirm a MAX17048/49. Fall back to the MAX17048/49-only registers, which
+  // are reserved on the MAX17043/44. Reserved addresses read back as all
+  // zeros, all ones or one aliased value. On the MAX17048/49 they hold at
+  // least one other value (CVALRT is 0x00FF and STATUS.RI is set after POR)
+  // and are not all identical.
+  if (is17048)
+  {
+    const uint8_t registers[] = {MAX17048_CVALRT, MAX17048_CRATE, MAX17048_VRESET_ID, MAX17048_STATUS};
+    boolean meaningful = false;
+    boolean allEqual = true;
+    for (uint8_t i = 0; i < sizeof(registers); i++)
+    {
+      uint16_t value = regs[DETECT_INDEX(registers[i])];
+      if ((value != 0x0000) && (value != 0xFFFF))
+        meaningful = true;
+      if (value != regs[DETECT_INDEX(registers[0])])
+        allEqual = false;
+    }
+    is17048 = meaningful && !allEqual;
+  }
+  boolean twoCell = (_device == MAX1704X_MAX17044) || (_device == MAX1704X_MAX17049);
+
+  if (is17048)
+    _device = twoCell ? MAX1704X_MAX17049 : MAX1704X_MAX17048;
+  else
+    _device = twoCell ? MAX1704X_MAX17044 : MAX1704X_MAX17043;
+
+  if (_printDebug == true)
+  {
+    _debugPort->print(F("detectDevice: detected a MAX1704"));
+    _debugPort->println(is17048 ? (twoCell ? F("9") : F("8")) : (twoCell ? F("4") : F("3")));
+  }
+
+  _deviceDetected = true;
+  invalidateCache(); // The conversion periods may have changed
+  return ((sfe_max1704x_devices_e)_device);
+}
+
+sfe_max1704x_devices_e SFE_MAX1704X::getDevice()
+{
+  return ((sfe_max1704x_devices_e)_device);
+}
+
 //Returns true if device answers on _deviceAddress
 boolean SFE_MAX1704X::isConnected(void)
 {
   _i2cPort->beginTransmission((uint8_t)MAX1704x_ADDRESS);
+  _busTransactions++;
+  _busBytes += 1;
   if (_i2cPort->endTransmission() == 0)
   {
     //Get version should return 0x001_
@@ -76,6 +151,140 @@ boolean SFE_MAX1704X::isConnected(void)
   return false;
 }
 
+//Returns true if device answers on _deviceAddress
+//Uses a single combined write/read transaction
+boolean SFE_MAX1704X::probe(void)
+{
+  uint16_t version;
+  if (readRegisters(MAX17043_VERSION, &version, 1) > 0)
+    return false;
+
+  //Get version should return 0x001_ (see isConnected)
+  return ((version & (1 << 4)) > 0);
+}
+
+uint8_t SFE_MAX1704X::probeChannels(const uint8_t *channels, uint8_t numChannels, sfe_max1704x_select_channel_t selectChannel, sfe_max1704x_probe_result_t *results)
+{
+  uint8_t found = 0;
+
+  for (uint8_t i = 0; i < numChannels; i++)
+  {
+    results[i].channel = channels[i];
+
+    unsigned long start = micros();
+    selectChannel(channels[i]);
+    unsigned long selected = micros();
+    results[i].present = probe();
+    results[i].probeMicros = micros() - selected;
+    results[i].selectMicros = selected - start;
+
+    if (results[i].present)
+      found++;
+  }
+
+  return (found);
+}
+
+float SFE_MAX1704X::getICCurrent(sfe_max1704x_devices_e device, sfe_max1704x_power_state_e state)
+{
+  if (device <= MAX1704X_MAX17044)
+    return ((state == MAX1704X_POWER_SLEEP) ? MAX17043_CURRENT_SLEEP_UA : MAX17043_CURRENT_ACTIVE_UA);
+
+  switch (state)
+  {
+    case MAX1704X_POWER_SLEEP:
+      return (MAX17048_CURRENT_SLEEP_UA);
+    case MAX1704X_POWER_HIBERNATE:
+      return (MAX17048_CURRENT_HIBERNATE_UA);
+    default:
+      return (MAX17048_CURRENT_ACTIVE_UA);
+  }
+}
+
+uint32_t SFE_MAX1704X::getBusTransactions()
+{
+  return (_busTransactions);
+}
+
+uint32_t SFE_MAX1704X::getBusBytes()
+{
+  return (_busBytes);
+}
+
+void SFE_MAX1704X::resetBusCounters()
+{
+  _busTransactions = 0;
+  _busBytes = 0;
+  for (uint8_t i = 0; i <= MAX1704X_POWER_SLEEP; i++)
+    _stateMillis[i] = 0;
+  _stateSince = millis();
+}
+
+// The state the IC is in: HIBERNATE while auto-hibernate is hibernating (PRIVATE)
+sfe_max1704x_power_state_e SFE_MAX1704X::getICPowerState()
+{
+  if ((_powerState == MAX1704X_POWER_AUTO_HIBERNATE) && _hibernating)
+    return (MAX1704X_POWER_HIBERNATE);
+  return (_powerState);
+}
+
+// Add the time since the last change to the state the IC is in (PRIVATE)
+void SFE_MAX1704X::accountPowerState()
+{
+  unsigned long now = millis();
+  _stateMillis[getICPowerState()] += now - _stateSince;
+  _stateSince = now;
+}
+
+// Change the tracked power state (PRIVATE)
+void SFE_MAX1704X::setTrackedPowerState(sfe_max1704x_power_state_e state)
+{
+  if (state == _powerState)
+    return;
+  accountPowerState();
+  _powerState = state;
+  _hibernating = false; // Auto-hibernate starts awake
+}
+
+// Record MODE.HIBSTAT (PRIVATE)
+void SFE_MAX1704X::hibstatRead(boolean hibstat)
+{
+  _hibstat = hibstat;
+  _hibstatTime = millis();
+  _hibstatValid = true;
+  if (hibstat != _hibernating)
+  {
+    accountPowerState();
+    _hibernating = hibstat;
+  }
+}
+
+float SFE_MAX1704X::estimateAverageCurrent(unsigned long elapsedMillis, uint32_t busClock, float mcuActiveCurrent)
+{
+  if ((elapsedMillis == 0) || (busClock == 0))
+    return (0.0);
+
+  // Weight each state's IC current by the time spent in it
+  accountPowerState();
+  uint32_t total = 0;
+  float current = 0.0;
+  for (uint8_t i = 0; i <= MAX1704X_POWER_SLEEP; i++)
+  {
+    total += _stateMillis[i];
+    current += getICCurrent((sfe_max1704x_devices_e)_device, (sfe_max1704x_power_state_e)i) * (float)_stateMillis[i];
+  }
+  if (total > 0)
+    current /= (float)total;
+  else
+    current = getICCurrent((sfe_max1704x_devices_e)_device, getICPowerState()); // No time has passed
+
+  // 9 clocks per byte (8 bits + ACK) plus START and STOP
+  float busSeconds = ((float)_busBytes * 9.0 + (float)_busTransactions * 2.0) / (float)busClock;
+  current += mcuActiveCurrent * busSeconds * 1000.0 / (float)elapsedMillis;
+
+  return (current);
+}
+
 //Enable or disable the printing of debug messages
 void SFE_MAX1704X::enableDebugging(Stream &debugPort)
 {
@@ -99,22 +308,27 @@ uint8_t SFE_MAX1704X::quickStart()
 
   // Note: on the MAX17048/49 this will also clear / disable EnSleep
 
+  invalidateCache(); // SOC will be recalculated
+  _enSleepSet = false;
+
   return write16(MAX17043_MODE_QUICKSTART, MAX17043_MODE);
 }
 
 float SFE_MAX1704X::getVoltage()
 {
-  uint16_t vCell;
-  vCell = read16(MAX17043_VCELL);
+  return convertVoltage(readCached(MAX17043_VCELL), (sfe_max1704x_devices_e)_device);
+}
 
-  if (_device <= MAX1704X_MAX17044)
+float SFE_MAX1704X::convertVoltage(uint16_t vCell, sfe_max1704x_devices_e device)
+{
+  if (device <= MAX1704X_MAX17044)
   {
     // On the MAX17043/44: vCell is a 12-bit register where each bit represents:
     // 1.25mV on the MAX17043
     // 2.5mV on the MAX17044
     vCell = (vCell) >> 4; // Align the 12 bits
 
-    float divider = 4096.0 / _full_scale;
+    float divider = 4096.0 / getFullScale(device);
 
     return (((float)vCell) / divider);
   }
@@ -124,7 +338,7 @@ float SFE_MAX1704X::getVoltage()
     // i.e. 78.125uV per LSB on the MAX17048
     // i.e. 156.25uV per LSB on the MAX17049
 
-    float divider = 65536.0 / _full_scale;
+    float divider = 65536.0 / getFullScale(device);
 
     return (((float)vCell) / divider);
   }
@@ -132,9 +346,12 @@ float SFE_MAX1704X::getVoltage()
 
 float SFE_MAX1704X::getSOC()
 {
-  uint16_t soc;
+  return convertSOC(readCached(MAX17043_SOC));
+}
+
+float SFE_MAX1704X::convertSOC(uint16_t soc)
+{
   float percent;
-  soc = read16(MAX17043_SOC);
   percent = (float)((soc & 0xFF00) >> 8);
   percent += ((float)(soc & 0x00FF)) / 256.0;
 
@@ -158,8 +375,7 @@ uint8_t SFE_MAX1704X::getID()
     return (0);
   }
 
-  uint16_t vresetID = read16(MAX17048_VRESET_ID);
-  return (vresetID & 0xFF);
+  return ((uint8_t)getField<MAX1704X_FIELD_ID>());
 }
 
 //Default is 0x4B = 75 (7bit, shifted from 0x96__)
@@ -175,11 +391,7 @@ uint8_t SFE_MAX1704X::setResetVoltage(uint8_t threshold)
     return (MAX17043_GENERIC_ERROR);
   }
 
-  uint16_t vreset = read16(MAX17048_VRESET_ID);
-  vreset &= 0x01FF;                     // Mask out bits to set
-  vreset |= ((uint16_t)threshold << 9); // Add new threshold
-
-  return write16(vreset, MAX17048_VRESET_ID);
+  return setField<MAX1704X_FIELD_VRESET>(threshold);
 }
 uint8_t SFE_MAX1704X::setResetVoltage(float threshold)
 {
@@ -199,8 +411,7 @@ uint8_t SFE_MAX1704X::getResetVoltage(void)
     return (0);
   }
 
-  uint16_t threshold = read16(MAX17048_VRESET_ID) >> 9;
-  return ((uint8_t)threshold);
+  return ((uint8_t)getField<MAX1704X_FIELD_VRESET>());
 }
 
 uint8_t SFE_MAX1704X::enableComparator(void)
@@ -214,9 +425,7 @@ uint8_t SFE_MAX1704X::enableComparator(void)
     return (MAX17043_GENERIC_ERROR);
   }
 
-  uint16_t vresetReg = read16(MAX17048_VRESET_ID);
-  vresetReg &= ~(1 << 8); //Clear bit to enable comparator
-  return write16(vresetReg, MAX17048_VRESET_ID);
+  return setField<MAX1704X_FIELD_COMPARATOR_DIS>(0); //Clear bit to enable comparator
 }
 
 uint8_t SFE_MAX1704X::disableComparator(void)
@@ -230,9 +439,7 @@ uint8_t SFE_MAX1704X::disableComparator(void)
     return (MAX17043_GENERIC_ERROR);
   }
 
-  uint16_t vresetReg = read16(MAX17048_VRESET_ID);
-  vresetReg |= (1 << 8); //Set bit to disable comparator
-  return write16(vresetReg, MAX17048_VRESET_ID);
+  return setField<MAX1704X_FIELD_COMPARATOR_DIS>(1); //Set bit to disable comparator
 }
 
 float SFE_MAX1704X::getChangeRate(void)
@@ -246,11 +453,100 @@ float SFE_MAX1704X::getChangeRate(void)
     return (0.0);
   }
 
-  int16_t changeRate = read16(MAX17048_CRATE);
+  return convertChangeRate(readCached(MAX17048_CRATE));
+}
+
+float SFE_MAX1704X::convertChangeRate(int16_t changeRate)
+{
   float changerate_f = changeRate * 0.208;
   return (changerate_f);
 }
 
+uint8_t SFE_MAX1704X::getSnapshot(sfe_max1704x_snapshot_t &snapshot)
+{
+  uint16_t block[MAX1704X_REGISTER_BLOCK_LENGTH];
+
+  // The MAX17043/44 registers end at CONFIG
+  uint8_t numRegisters = MAX1704X_REGISTER_BLOCK_LENGTH;
+  if (_device <= MAX1704X_MAX17044)
+    numRegisters = REGISTER_BLOCK_INDEX(MAX17043_CONFIG) + 1;
+
+  uint8_t result = readRegisters(MAX1704X_REGISTER_BLOCK_START, block, numRegisters);
+  if (result)
+    return (result);
+
+  unsigned long now = millis();
+  snapshot.millis = now;
+  snapshot.device = (sfe_max1704x_devices_e)_device;
+  snapshot.vcell = block[REGISTER_BLOCK_INDEX(MAX17043_VCELL)];
+  snapshot.soc = block[REGISTER_BLOCK_INDEX(MAX17043_SOC)];
+  snapshot.mode = block[REGISTER_BLOCK_INDEX(MAX17043_MODE)];
+  snapshot.config = block[REGISTER_BLOCK_INDEX(MAX17043_CONFIG)];
+  snapshot.crate = 0;
+  snapshot.status = 0;
+
+  if (_device > MAX1704X_MAX17044)
+  {
+    snapshot.crate = (int16_t)block[REGISTER_BLOCK_INDEX(MAX17048_CRATE)];
+    snapshot.status = block[REGISTER_BLOCK_INDEX(MAX17048_STATUS)];
+
+    hibstatRead((snapshot.mode & MAX17048_MODE_HIBSTAT) > 0);
+  }
+
+  // Refresh the measurement cache while we are here
+  _cacheValue[0] = snapshot.vcell;
+  _cacheValue[1] = snapshot.soc;
+  _cacheValue[2] = (uint16_t)snapshot.crate;
+  _cacheTime[0] = _cacheTime[1] = _cacheTime[2] = now;
+  _cacheValid = (_device > MAX1704X_MAX17044) ? 0x07 : 0x03;
+
+  return (0);
+}
+
+uint8_t SFE_MAX1704X::serializeSnapshot(const sfe_max1704x_snapshot_t &snapshot, uint8_t *frame, uint8_t frameSize)
+{
+  if (frameSize < MAX1704X_FRAME_LENGTH)
+    return (0);
+
+  frame[0] = MAX1704X_FRAME_VERSION;
+  frame[1] = (uint8_t)snapshot.device;
+  frame[2] = snapshot.millis >> 24;
+  frame[3] = snapshot.millis >> 16;
+  frame[4] = snapshot.millis >> 8;
+  frame[5] = snapshot.millis;
+  frame[6] = snapshot.vcell >> 8;
+  frame[7] = snapshot.vcell;
+  frame[8] = snapshot.soc >> 8;
+  frame[9] = snapshot.soc;
+  frame[10] = (uint16_t)snapshot.crate >> 8;
+  frame[11] = (uint16_t)snapshot.crate;
+  frame[12] = snapshot.mode >> 8;
+  frame[13] = snapshot.mode;
+  frame[14] = snapshot.config >> 8;
+  frame[15] = snapshot.config;
+  frame[16] = snapshot.status >> 8;
+  frame[17] = snapshot.status;
+
+  return (MAX1704X_FRAME_LENGTH);
+}
+
+uint8_t SFE_MAX1704X::deserializeSnapshot(const uint8_t *frame, uint8_t frameLength, sfe_max1704x_snapshot_t &snapshot)
+{
+  if ((frameLength < MAX1704X_FRAME_LENGTH) || (frame[0] != MAX1704X_FRAME_VERSION) || (frame[1] > MAX1704X_MAX17049))
+    return (MAX17043_GENERIC_ERROR);
+
+  snapshot.device = (sfe_max1704x_devices_e)frame[1];
+  snapshot.millis = ((uint32_t)frame[2] << 24) | ((uint32_t)frame[3] << 16) | ((uint32_t)frame[4] << 8) | frame[5];
+  snapshot.vcell = ((uint16_t)frame[6] << 8) | frame[7];
+  snapshot.soc = ((uint16_t)frame[8] << 8) | frame[9];
+  snapshot.crate = (int16_t)(((uint16_t)frame[10] << 8) | frame[11]);
+  snapshot.mode = ((uint16_t)frame[12] << 8) | frame[13];
+  snapshot.config = ((uint16_t)frame[14] << 8) | frame[15];
+  snapshot.status = ((uint16_t)frame[16] << 8) | frame[17];
+
+  return (0);
+}
+
 uint8_t SFE_MAX1704X::getStatus(void)
 {
   if (_device <= MAX1704X_MAX17044)
@@ -439,9 +735,7 @@ uint8_t SFE_MAX1704X::enableAlert(void)
     return (MAX17043_GENERIC_ERROR);
   }
 
-  uint16_t statusReg = read16(MAX17048_STATUS);
-  statusReg |= MAX1704x_STATUS_EnVR; // Set EnVR bit
-  return write16(statusReg, MAX17048_STATUS);
+  return setField<MAX1704X_FIELD_ENVR>(1); // Set EnVR bit
 }
 
 uint8_t SFE_MAX1704X::disableAlert(void)
@@ -455,15 +749,12 @@ uint8_t SFE_MAX1704X::disableAlert(void)
     return (MAX17043_GENERIC_ERROR);
   }
 
-  uint16_t statusReg = read16(MAX17048_STATUS);
-  statusReg &= ~MAX1704x_STATUS_EnVR; // Clear EnVR bit
-  return write16(statusReg, MAX17048_STATUS);
+  return setField<MAX1704X_FIELD_ENVR>(0); // Clear EnVR bit
 }
 
 uint8_t SFE_MAX1704X::getThreshold()
 {
-  uint16_t configReg = read16(MAX17043_CONFIG);
-  uint8_t threshold = (configReg & 0x001F);
+  uint8_t threshold = getField<MAX1704X_FIELD_ATHD>();
 
   // It has an LSb weight of 1%, and can be programmed from 1% to 32%.
   // The value is (32 - ATHD)%, e.g.: 00000=32%, 00001=31%, 11111=1%.
@@ -480,15 +771,10 @@ uint8_t SFE_MAX1704X::setThreshold(uint8_t percent)
   // It has an LSb weight of 1%, and can be programmed from 1% to 32%.
   // The value is (32 - ATHD)%, e.g.: 00000=32%, 00001=31%, 11111=1%.
   // Let's convert our percent to that first:
-  percent = constrain(percent, 0, 32);
+  percent = constrain(percent, 1, 32);
   percent = 32 - percent;
 
-  // Read config reg, so we don't modify any other values:
-  uint16_t configReg = read16(MAX17043_CONFIG);
-  configReg &= 0xFFE0;  // Mask out threshold bits
-  configReg |= percent; // Add new threshold
-
-  return write16(configReg, MAX17043_CONFIG);
+  return setField<MAX1704X_FIELD_ATHD>(percent);
 }
 
 // In sleep mode, the IC halts all operations, reducing current
@@ -499,12 +785,15 @@ uint8_t SFE_MAX1704X::setThreshold(uint8_t percent)
 // SOC error. Wake up the IC before charging or discharging.
 uint8_t SFE_MAX1704X::sleep()
 {
+  invalidateCache();
+
   if (_device > MAX1704X_MAX17044)
   {
     // On the MAX17048, we also have to set the EnSleep bit in the MODE register
     uint8_t result =  write16(MAX17048_MODE_ENSLEEP, MAX17043_MODE);
     if (result)
       return (result); // Write failed. Bail.
+    _enSleepSet = true;
   }
 
   // Read config reg, so we don't modify any other values:
@@ -520,11 +809,16 @@ uint8_t SFE_MAX1704X::sleep()
 
   configReg |= MAX17043_CONFIG_SLEEP; // Set sleep bit
 
-  return write16(configReg, MAX17043_CONFIG);
+  uint8_t result = write16(configReg, MAX17043_CONFIG);
+  if (result == 0)
+    setTrackedPowerState(MAX1704X_POWER_SLEEP);
+  return (result);
 }
 
 uint8_t SFE_MAX1704X::wake()
 {
+  invalidateCache();
+
   // Read config reg, so we don't modify any other values:
   uint16_t configReg = read16(MAX17043_CONFIG);
   if (!(configReg & MAX17043_CONFIG_SLEEP))
@@ -542,11 +836,14 @@ uint8_t SFE_MAX1704X::wake()
   if (result)
     return (result); // Write failed. Bail.
 
+  sleepCleared(); // We are awake
+
   if (_device > MAX1704X_MAX17044)
   {
     // On the MAX17048, we should also clear the EnSleep bit in the MODE register
     // Strictly, this will clear the QuickStart bit too. Which is probably a good thing,
     // as I don't think we can do a read-modify-write?
+    _enSleepSet = false;
     return write16(0x0000, MAX17043_MODE);
   }
   else
@@ -555,6 +852,129 @@ uint8_t SFE_MAX1704X::wake()
   }
 }
 
+uint8_t SFE_MAX1704X::setPowerState(sfe_max1704x_power_state_e state)
+{
+  if ((_device <= MAX1704X_MAX17044) && ((state == MAX1704X_POWER_HIBERNATE) || (state == MAX1704X_POWER_AUTO_HIBERNATE)))
+  {
+    if (_printDebug == true)
+    {
+      _debugPort->println(F("setPowerState: hibernate is not supported on this device"));
+    }
+    return (MAX17043_GENERIC_ERROR);
+  }
+
+  if (state == MAX1704X_POWER_UNKNOWN)
+    return (MAX17043_GENERIC_ERROR);
+
+  if (state == _powerState)
+    return (0); // Nothing to do
+
+  unsigned long startTime = micros();
+  uint8_t result;
+
+  invalidateCache();
+
+  if (state == MAX1704X_POWER_SLEEP)
+  {
+    if ((_device > MAX1704X_MAX17044) && (_enSleepSet == false))
+    {
+      // On the MAX17048, sleep must be enabled by MODE.EnSleep first
+      result = write16(MAX17048_MODE_ENSLEEP, MAX17043_MODE);
+      if (result)
+        return (result); // Write failed. Bail.
+      _enSleepSet = true;
+    }
+
+    // Read config reg, so we don't modify any other values:
+    uint16_t configReg = read16(MAX17043_CONFIG);
+    result = write16(configReg | MAX17043_CONFIG_SLEEP, MAX17043_CONFIG);
+    if (result)
+      return (result); // Write failed. Bail.
+  }
+  else
+  {
+    if ((_powerState == MAX1704X_POWER_SLEEP) || (_powerState == MAX1704X_POWER_UNKNOWN))
+    {
+      // Read config reg, so we don't modify any other values:
+      uint16_t configReg = read16(MAX17043_CONFIG);
+      if (configReg & MAX17043_CONFIG_SLEEP)
+      {
+        result = write16(configReg & ~MAX17043_CONFIG_SLEEP, MAX17043_CONFIG); // Clear sleep bit
+        if (result)
+          return (result); // Write failed. Bail.
+      }
+    }
+
+    if (_device > MAX1704X_MAX17044)
+    {
+      uint16_t hibrt = MAX17048_HIBRT_DISHIB;
+      if (state == MAX1704X_POWER_HIBERNATE)
+        hibrt = MAX17048_HIBRT_ENHIB;
+      else if (state == MAX1704X_POWER_AUTO_HIBERNATE)
+        hibrt = _autoHibrt;
+
+      if ((_hibrtKnown == false) || (_hibrt != hibrt))
+      {
+        result = write16(hibrt, MAX17048_HIBRT);
+        if (result)
+          return (result); // Write failed. Bail.
+        hibrtWritten(hibrt);
+      }
+    }
+  }
+
+  setTrackedPowerState(state);
+  _powerTransitionMicros = micros() - startTime;
+  return (0);
+}
+
+sfe_max1704x_power_state_e SFE_MAX1704X::getPowerState()
+{
+  return (_powerState);
+}
+
+unsigned long SFE_MAX1704X::getPowerTransitionMicros()
+{
+  return (_powerTransitionMicros);
+}
+
+// Record that HIBRT has been written with [hibrt] and update the power state (PRIVATE)
+void SFE_MAX1704X::hibrtWritten(uint16_t hibrt)
+{
+  // Every HIBRT write (setField, applyProfile, staged writes, ...) passes
+  // through here. New thresholds may start or end hibernation, changing the
+  // conversion period the measurement cache relies on
+  if ((_hibrtKnown == false) || (hibrt != _hibrt))
+    invalidateCache();
+
+  _hibrt = hibrt;
+  _hibrtKnown = true;
+
+  if ((hibrt != MAX17048_HIBRT_ENHIB) && (hibrt != MAX17048_HIBRT_DISHIB))
+    _autoHibrt = hibrt; // Remember the thresholds for auto-hibernate
+
+  if (_powerState == MAX1704X_POWER_SLEEP)
+    return; // Still asleep
+
+  if (hibrt == MAX17048_HIBRT_DISHIB)
+    setTrackedPowerState(MAX1704X_POWER_ACTIVE);
+  else if (hibrt == MAX17048_HIBRT_ENHIB)
+    setTrackedPowerState(MAX1704X_POWER_HIBERNATE);
+  else
+    setTrackedPowerState(MAX1704X_POWER_AUTO_HIBERNATE);
+}
+
+// Record that CONFIG.SLEEP has been cleared (PRIVATE)
+void SFE_MAX1704X::sleepCleared()
+{
+  // Work out which state from HIBRT, if we know it
+  setTrackedPowerState(MAX1704X_POWER_UNKNOWN);
+  if (_hibrtKnown)
+    hibrtWritten(_hibrt);
+  else if (_device <= MAX1704X_MAX17044)
+    setTrackedPowerState(MAX1704X_POWER_ACTIVE);
+}
+
 // Writing a value of 0x5400 to the CMD Register causes
 // the device to completely reset as if power had been
 // removed (see the Power-On Reset (POR) section). The
@@ -564,14 +984,79 @@ uint8_t SFE_MAX1704X::wake()
 // Output: Positive integer on success, 0 on fail.
 uint8_t SFE_MAX1704X::reset()
 {
+  invalidateCache();
+
+  // Every register returns to its POR value
+  setTrackedPowerState(MAX1704X_POWER_UNKNOWN);
+  _hibrtKnown = false;
+  _autoHibrt = 0x8030;
+  _enSleepSet = false;
+
   return write16(MAX17043_COMMAND_POR, MAX17043_COMMAND);
 }
 
+uint8_t SFE_MAX1704X::resetAndWait(sfe_max1704x_reset_timing_t *timing, unsigned long timeoutMillis, unsigned long pollMillis)
+{
+  unsigned long start = micros();
+  unsigned long startMillis = millis();
+
+  reset(); // The IC resets before it can ACK, so the result is meaningless
+  unsigned long commanded = micros();
+
+  // Phase 1: wait for the IC to answer again
+  boolean present = false;
+  while (!(present = probe()) && ((millis() - startMillis) < timeoutMillis))
+    delay(pollMillis);
+  unsigned long reappeared = micros();
+
+  // Phase 2: wait for the first conversion. VCELL and SOC read as zero until then
+  uint16_t measurements[2] = {0, 0}; // VCELL, SOC
+  boolean ready = false;
+  if (present)
+  {
+    while (true)
+    {
+      if ((readRegisters(MAX17043_VCELL, measurements, 2) == 0) && (measurements[0] != 0) && (measurements[1] != 0))
+      {
+        ready = true;
+        break;
+      }
+      if ((millis() - startMillis) >= timeoutMillis)
+      {
+        ready = (measurements[0] != 0); // Valid VCELL: SOC really is zero
+        break;
+      }
+      delay(pollMillis);
+    }
+  }
+  unsigned long finished = micros();
+
+  if (timing != NULL)
+  {
+    timing->commandMicros = commanded - start;
+    timing->reappearMicros = reappeared - commanded;
+    timing->readyMicros = finished - reappeared;
+    timing->totalMicros = finished - start;
+  }
+
+  if (!ready)
+  {
+    if (_printDebug == true)
+    {
+      if (!present)
+        _debugPort->println(F("resetAndWait: IC did not reappear"));
+      else
+        _debugPort->println(F("resetAndWait: no valid VCELL"));
+    }
+    return (MAX17043_GENERIC_ERROR);
+  }
+
+  return (0);
+}
+
 uint8_t SFE_MAX1704X::getCompensation()
 {
-  uint16_t configReg = read16(MAX17043_CONFIG);
-  uint8_t compensation = (configReg & 0xFF00) >> 8;
-  return compensation;
+  return ((uint8_t)getField<MAX1704X_FIELD_RCOMP>());
 }
 
 uint16_t SFE_MAX1704X::getConfigRegister()
@@ -583,11 +1068,28 @@ uint8_t SFE_MAX1704X::setCompensation(uint8_t newCompensation)
 {
   // The CONFIG register compensates the ModelGauge algorith. The upper 8 bits
   // of the 16-bit register control the compensation.
-  // Read the original configReg, so we can leave the lower 8 bits alone:
-  uint16_t configReg = read16(MAX17043_CONFIG);
-  configReg &= 0x00FF; // Mask out compensation bits
-  configReg |= ((uint16_t)newCompensation) << 8;
-  return write16(configReg, MAX17043_CONFIG);
+  return setField<MAX1704X_FIELD_RCOMP>(newCompensation);
+}
+
+uint8_t SFE_MAX1704X::calculateCompensation(float temperature, uint8_t rcomp0, float tempCoUp, float tempCoDown)
+{
+  float rcomp = rcomp0;
+  if (temperature > 20.0)
+    rcomp += (temperature - 20.0) * tempCoUp;
+  else
+    rcomp += (temperature - 20.0) * tempCoDown;
+
+  // Round and limit to the 8 bits of CONFIG.RCOMP
+  if (rcomp <= 0.0)
+    return (0);
+  if (rcomp >= 255.0)
+    return (255);
+  return ((uint8_t)(rcomp + 0.5));
+}
+
+uint8_t SFE_MAX1704X::compensateTemperature(float temperature, uint8_t rcomp0, float tempCoUp, float tempCoDown)
+{
+  return setCompensation(calculateCompensation(temperature, rcomp0, tempCoUp, tempCoDown));
 }
 
 // VALRT Register:
@@ -606,10 +1108,7 @@ uint8_t SFE_MAX1704X::setVALRTMax(uint8_t threshold)
     return (MAX17043_GENERIC_ERROR);
   }
 
-  uint16_t valrt = read16(MAX17048_CVALRT);
-  valrt &= 0xFF00; // Mask off max bits
-  valrt |= (uint16_t)threshold;
-  return write16(valrt, MAX17048_CVALRT);
+  return setField<MAX1704X_FIELD_VALRT_MAX>(threshold);
 }
 uint8_t SFE_MAX1704X::setVALRTMax(float threshold)
 {
@@ -628,9 +1127,7 @@ uint8_t SFE_MAX1704X::getVALRTMax()
     return (0);
   }
 
-  uint16_t valrt = read16(MAX17048_CVALRT);
-  valrt &= 0x00FF; // Mask off max bits
-  return ((uint8_t)valrt);
+  return ((uint8_t)getField<MAX1704X_FIELD_VALRT_MAX>());
 }
 
 uint8_t SFE_MAX1704X::setVALRTMin(uint8_t threshold)
@@ -644,10 +1141,7 @@ uint8_t SFE_MAX1704X::setVALRTMin(uint8_t threshold)
     return (MAX17043_GENERIC_ERROR);
   }
 
-  uint16_t valrt = read16(MAX17048_CVALRT);
-  valrt &= 0x00FF; // Mask off min bits
-  valrt |= ((uint16_t)threshold) << 8;
-  return write16(valrt, MAX17048_CVALRT);
+  return setField<MAX1704X_FIELD_VALRT_MIN>(threshold);
 }
 uint8_t SFE_MAX1704X::setVALRTMin(float threshold)
 {
@@ -666,9 +1160,7 @@ uint8_t SFE_MAX1704X::getVALRTMin()
     return (0);
   }
 
-  uint16_t valrt = read16(MAX17048_CVALRT);
-  valrt >>= 8; // Shift min into LSB
-  return ((uint8_t)valrt);
+  return ((uint8_t)getField<MAX1704X_FIELD_VALRT_MIN>());
 }
 
 bool SFE_MAX1704X::isHibernating()
@@ -683,7 +1175,8 @@ bool SFE_MAX1704X::isHibernating()
   }
 
   uint16_t mode = read16(MAX17043_MODE);
-  return ((mode & MAX17048_MODE_HIBSTAT) > 0);
+  hibstatRead((mode & MAX17048_MODE_HIBSTAT) > 0);
+  return (_hibstat);
 }
 
 uint8_t SFE_MAX1704X::getHIBRTActThr()
@@ -697,9 +1190,7 @@ uint8_t SFE_MAX1704X::getHIBRTActThr()
     return (0);
   }
 
-  uint16_t hibrt = read16(MAX17048_HIBRT);
-  hibrt &= 0x00FF; // Mask off Act bits
-  return ((uint8_t)hibrt);
+  return ((uint8_t)getField<MAX1704X_FIELD_HIBRT_ACTTHR>());
 }
 
 uint8_t SFE_MAX1704X::setHIBRTActThr(uint8_t threshold)
@@ -713,10 +1204,7 @@ uint8_t SFE_MAX1704X::setHIBRTActThr(uint8_t threshold)
     return (MAX17043_GENERIC_ERROR);
   }
 
-  uint16_t hibrt = read16(MAX17048_HIBRT);
-  hibrt &= 0xFF00; // Mask off Act bits
-  hibrt |= (uint16_t)threshold;
-  return write16(hibrt, MAX17048_HIBRT);
+  return setField<MAX1704X_FIELD_HIBRT_ACTTHR>(threshold);
 }
 uint8_t SFE_MAX1704X::setHIBRTActThr(float threshold)
 {
@@ -736,9 +1224,7 @@ uint8_t SFE_MAX1704X::getHIBRTHibThr()
     return (0);
   }
 
-  uint16_t hibrt = read16(MAX17048_HIBRT);
-  hibrt >>= 8; // Shift HibThr into LSB
-  return ((uint8_t)hibrt);
+  return ((uint8_t)getField<MAX1704X_FIELD_HIBRT_HIBTHR>());
 }
 
 uint8_t SFE_MAX1704X::setHIBRTHibThr(uint8_t threshold)
@@ -752,10 +1238,7 @@ uint8_t SFE_MAX1704X::setHIBRTHibThr(uint8_t threshold)
     return (MAX17043_GENERIC_ERROR);
   }
 
-  uint16_t hibrt = read16(MAX17048_HIBRT);
-  hibrt &= 0x00FF; // Mask off Hib bits
-  hibrt |= ((uint16_t)threshold) << 8;
-  return write16(hibrt, MAX17048_HIBRT);
+  return setField<MAX1704X_FIELD_HIBRT_HIBTHR>(threshold);
 }
 uint8_t SFE_MAX1704X::setHIBRTHibThr(float threshold)
 {
@@ -775,7 +1258,12 @@ uint8_t SFE_MAX1704X::enableHibernate()
     return (MAX17043_GENERIC_ERROR);
   }
 
-  return write16(MAX17048_HIBRT_ENHIB, MAX17048_HIBRT);
+  invalidateCache(); // HIBSTAT will change
+
+  uint8_t result = write16(MAX17048_HIBRT_ENHIB, MAX17048_HIBRT);
+  if (result == 0)
+    hibrtWritten(MAX17048_HIBRT_ENHIB);
+  return (result);
 }
 
 uint8_t SFE_MAX1704X::disableHibernate()
@@ -789,35 +1277,947 @@ uint8_t SFE_MAX1704X::disableHibernate()
     return (MAX17043_GENERIC_ERROR);
   }
 
-  return write16(MAX17048_HIBRT_DISHIB, MAX17048_HIBRT);
+  invalidateCache(); // HIBSTAT will change
+
+  uint8_t result = write16(MAX17048_HIBRT_DISHIB, MAX17048_HIBRT);
+  if (result == 0)
+    hibrtWritten(MAX17048_HIBRT_DISHIB);
+  return (result);
 }
 
-uint8_t SFE_MAX1704X::write16(uint16_t data, uint8_t address)
+void SFE_MAX1704X::enableCache()
 {
-  uint8_t msb, lsb;
-  msb = (data & 0xFF00) >> 8;
-  lsb = (data & 0x00FF);
-  _i2cPort->beginTransmission(MAX1704x_ADDRESS);
-  _i2cPort->write(address);
-  _i2cPort->write(msb);
-  _i2cPort->write(lsb);
-  return (_i2cPort->endTransmission());
+  invalidateCache();
+  _cacheEnabled = true;
 }
 
-uint16_t SFE_MAX1704X::read16(uint8_t address)
+void SFE_MAX1704X::disableCache()
 {
-  uint8_t msb, lsb;
-  int16_t timeout = 1000;
+  _cacheEnabled = false;
+}
 
-  _i2cPort->beginTransmission(MAX1704x_ADDRESS);
-  _i2cPort->write(address);
-  _i2cPort->endTransmission(false);
+void SFE_MAX1704X::invalidateCache()
+{
+  _cacheValid = 0;
+  _hibstatValid = false;
+}
 
-  _i2cPort->requestFrom(MAX1704x_ADDRESS, 2);
-  while ((_i2cPort->available() < 2) && (timeout-- > 0))
-    delay(1);
-  msb = _i2cPort->read();
-  lsb = _i2cPort->read();
+// Read a register through the measurement cache (PRIVATE)
+// VCELL, SOC and CRATE are only re-read once the IC could have completed a
+// new conversion. All other registers are read directly.
+uint16_t SFE_MAX1704X::readCached(uint8_t address)
+{
+  if (_cacheEnabled == false)
+    return read16(address);
 
-  return ((uint16_t)msb << 8) | lsb;
+  uint8_t index;
+  switch (address)
+  {
+    case MAX17043_VCELL:
+      index = 0;
+      break;
+    case MAX17043_SOC:
+      index = 1;
+      break;
+    case MAX17048_CRATE:
+      index = 2;
+      break;
+    default:
+      return read16(address);
+  }
+
+  unsigned long period = MAX17043_UPDATE_PERIOD_MS;
+  if (_device > MAX1704X_MAX17044)
+  {
+    // The MAX17048/49 conversion period depends on whether the IC is hibernating.
+    // Only re-check HIBSTAT once per hibernate conversion period.
+    if ((_hibstatValid == false) || ((millis() - _hibstatTime) >= MAX17048_UPDATE_PERIOD_HIBERNATE_MS))
+      isHibernating(); // Updates _hibstat
+    period = _hibstat ? MAX17048_UPDATE_PERIOD_HIBERNATE_MS : MAX17048_UPDATE_PERIOD_ACTIVE_MS;
+  }
+
+  unsigned long now = millis();
+  if ((_cacheValid & (1 << index)) && ((now - _cacheTime[index]) < period))
+    return (_cacheValue[index]); // Still fresh
+
+  _cacheValue[index] = read16(address);
+  _cacheTime[index] = now;
+  _cacheValid |= (1 << index);
+  return (_cacheValue[index]);
+}
+
+// Index of a register within the configuration block
+#define CONFIG_BLOCK_INDEX(reg) (((reg) - MAX1704X_CONFIG_BLOCK_START) >> 1)
+
+void SFE_MAX1704X::getDefaultProfile(sfe_max1704x_profile_t &profile)
+{
+  profile.threshold = 4;               // CONFIG default 0x971C: ATHD = 0x1C = 4%
+  profile.compensation = 0x97;
+  profile.socAlert = false;
+  profile.valrtMax = 0xFF;             // CVALRT default 0x00FF
+  profile.valrtMin = 0x00;
+  profile.hibrtActThr = 0x30;          // HIBRT default 0x8030
+  profile.hibrtHibThr = 0x80;
+  profile.resetVoltage = (0x96 >> 1);  // VRESET_ID default 0x96__ = 3.0V
+  profile.comparator = true;
+  profile.voltageResetAlert = false;   // STATUS default 0x01__
+}
+
+// Burst read the configuration registers (PRIVATE)
+// On the MAX17043/44 only CONFIG exists, so only that is read.
+uint8_t SFE_MAX1704X::readConfigBlock(uint16_t *block)
+{
+  if (_device <= MAX1704X_MAX17044)
+    return readRegisters(MAX17043_CONFIG, &block[CONFIG_BLOCK_INDEX(MAX17043_CONFIG)], 1);
+
+  return readRegisters(MAX1704X_CONFIG_BLOCK_START, block, MAX1704X_CONFIG_BLOCK_LENGTH);
+}
+
+uint8_t SFE_MAX1704X::getProfile(sfe_max1704x_profile_t &profile)
+{
+  uint16_t block[MAX1704X_CONFIG_BLOCK_LENGTH];
+
+  getDefaultProfile(profile); // Fields which do not exist on the MAX17043/44 keep their defaults
+
+  uint8_t result = readConfigBlock(block);
+  if (result)
+    return (result);
+
+  uint16_t configReg = block[CONFIG_BLOCK_INDEX(MAX17043_CONFIG)];
+  profile.threshold = 32 - (configReg & 0x001F);
+  profile.compensation = configReg >> 8;
+
+  if (_device > MAX1704X_MAX17044)
+  {
+    profile.socAlert = (configReg & MAX17043_CONFIG_ALSC) > 0;
+    uint16_t valrt = block[CONFIG_BLOCK_INDEX(MAX17048_CVALRT)];
+    profile.valrtMax = valrt & 0x00FF;
+    profile.valrtMin = valrt >> 8;
+    uint16_t hibrt = block[CONFIG_BLOCK_INDEX(MAX17048_HIBRT)];
+    profile.hibrtActThr = hibrt & 0x00FF;
+    profile.hibrtHibThr = hibrt >> 8;
+    uint16_t vreset = block[CONFIG_BLOCK_INDEX(MAX17048_VRESET_ID)];
+    profile.resetVoltage = vreset >> 9;
+    profile.comparator = (vreset & (1 << 8)) == 0;
+    profile.voltageResetAlert = (block[CONFIG_BLOCK_INDEX(MAX17048_STATUS)] & MAX1704x_STATUS_EnVR) > 0;
+  }
+
+  return (0);
+}
+
+uint8_t SFE_MAX1704X::applyProfile(const sfe_max1704x_profile_t &profile)
+{
+  // The registers we may write, and the bits within them which the profile controls
+  const uint8_t registers[] = {MAX17043_CONFIG, MAX17048_HIBRT, MAX17048_CVALRT, MAX17048_VRESET_ID, MAX17048_STATUS};
+  const uint16_t masks[] = {0xFF5F, 0xFFFF, 0xFFFF, 0xFF00, MAX1704x_STATUS_EnVR}; // CONFIG: everything but SLEEP and ALRT
+  const uint8_t numRegisters = (_device <= MAX1704X_MAX17044) ? 1 : sizeof(registers);
+
+  uint16_t current[MAX1704X_CONFIG_BLOCK_LENGTH];
+  uint16_t target[MAX1704X_CONFIG_BLOCK_LENGTH];
+
+  uint8_t result = readConfigBlock(current);
+  if (result)
+    return (result);
+  memcpy(target, current, sizeof(current));
+
+  // Build the new register contents
+  uint8_t threshold = 32 - constrain(profile.threshold, 1, 32);
+  uint16_t configReg = target[CONFIG_BLOCK_INDEX(MAX17043_CONFIG)];
+  configReg &= ~masks[0];
+  configReg |= ((uint16_t)profile.compensation) << 8;
+  configReg |= threshold;
+  if ((_device > MAX1704X_MAX17044) && profile.socAlert)
+    configReg |= MAX17043_CONFIG_ALSC;
+  target[CONFIG_BLOCK_INDEX(MAX17043_CONFIG)] = configReg;
+
+  target[CONFIG_BLOCK_INDEX(MAX17048_HIBRT)] = (((uint16_t)profile.hibrtHibThr) << 8) | profile.hibrtActThr;
+  target[CONFIG_BLOCK_INDEX(MAX17048_CVALRT)] = (((uint16_t)profile.valrtMin) << 8) | profile.valrtMax;
+
+  uint16_t vreset = target[CONFIG_BLOCK_INDEX(MAX17048_VRESET_ID)] & 0x00FF; // Keep the ID
+  vreset |= ((uint16_t)(profile.resetVoltage & 0x7F)) << 9;
+  if (profile.comparator == false)
+    vreset |= (1 << 8); // Set bit to disable comparator
+  target[CONFIG_BLOCK_INDEX(MAX17048_VRESET_ID)] = vreset;
+
+  uint16_t statusReg = target[CONFIG_BLOCK_INDEX(MAX17048_STATUS)] & ~MAX1704x_STATUS_EnVR;
+  if (profile.voltageResetAlert)
+    statusReg |= MAX1704x_STATUS_EnVR;
+  target[CONFIG_BLOCK_INDEX(MAX17048_STATUS)] = statusReg;
+
+  // Write only the registers which need to change
+  boolean written = false;
+  for (uint8_t i = 0; i < numRegisters; i++)
+  {
+    uint8_t index = CONFIG_BLOCK_INDEX(registers[i]);
+    if (target[index] != current[index])
+    {
+      result = write16(target[index], registers[i]);
+      if (result)
+        return (result); // Write failed. Bail.
+      if (registers[i] == MAX17048_HIBRT)
+        hibrtWritten(target[index]);
+      written = true;
+    }
+  }
+
+  if (written == false)
+    return (0); // Nothing to do
+
+  // Verify everything with a single burst read
+  result = readConfigBlock(current);
+  if (result)
+    return (result);
+  for (uint8_t i = 0; i < numRegisters; i++)
+  {
+    uint8_t index = CONFIG_BLOCK_INDEX(registers[i]);
+    if ((current[index] & masks[i]) != (target[index] & masks[i]))
+    {
+      if (_printDebug == true)
+      {
+        _debugPort->print(F("applyProfile: verification failed for register 0x"));
+        _debugPort->println(registers[i], HEX);
+      }
+      return (MAX17043_GENERIC_ERROR);
+    }
+  }
+
+  return (0);
+}
+
+// STATUS alert flags, aligned
+#define STATUS_ALERT_FLAGS ((uint16_t)(MAX1704x_STATUS_VH | MAX1704x_STATUS_VL | MAX1704x_STATUS_VR | MAX1704x_STATUS_HD | MAX1704x_STATUS_SC) << 8)
+
+// Write the VALRT window centered on [vcell], if it differs from [cvalrt] (PRIVATE)
+uint8_t SFE_MAX1704X::centerAlertWindow(uint16_t vcell, uint16_t cvalrt)
+{
+  // VCELL is 78.125uV per cell per LSB. VALRT is 20mV per cell per LSB: 256 times larger
+  uint8_t center = vcell >> 8;
+  uint8_t valrtMin = (center > _alertWindow) ? center - _alertWindow : 0;
+  uint8_t valrtMax = (center < (0xFF - _alertWindow)) ? center + _alertWindow : 0xFF;
+  uint16_t newValrt = (((uint16_t)valrtMin) << 8) | valrtMax;
+
+  if (newValrt == cvalrt)
+    return (0); // Nothing to do
+
+  return write16(newValrt, MAX17048_CVALRT);
+}
+
+uint8_t SFE_MAX1704X::enableAlertTracking(uint8_t window, uint8_t emptyThreshold)
+{
+  if (_device <= MAX1704X_MAX17044)
+  {
+    if (_printDebug == true)
+    {
+      _debugPort->println(F("enableAlertTracking: not supported on this device"));
+    }
+    return (MAX17043_GENERIC_ERROR);
+  }
+
+  uint16_t block[MAX1704X_REGISTER_BLOCK_LENGTH];
+  uint8_t result = readRegisters(MAX1704X_REGISTER_BLOCK_START, block, MAX1704X_REGISTER_BLOCK_LENGTH);
+  if (result)
+    return (result);
+
+  _alertWindow = window;
+  result = centerAlertWindow(block[REGISTER_BLOCK_INDEX(MAX17043_VCELL)], block[REGISTER_BLOCK_INDEX(MAX17048_CVALRT)]);
+  if (result)
+    return (result); // Write failed. Bail.
+
+  // Set ALSC and the threshold, and clear any old alert
+  uint16_t configReg = block[REGISTER_BLOCK_INDEX(MAX17043_CONFIG)];
+  uint16_t newConfig = configReg & ~(MAX17043_CONFIG_ALERT | 0x001F);
+  newConfig |= MAX17043_CONFIG_ALSC | (32 - constrain(emptyThreshold, 1, 32));
+  if (newConfig != configReg)
+  {
+    result = write16(newConfig, MAX17043_CONFIG);
+    if (result)
+      return (result); // Write failed. Bail.
+  }
+
+  // Clear any old alert flags
+  uint16_t statusReg = block[REGISTER_BLOCK_INDEX(MAX17048_STATUS)];
+  if (statusReg & STATUS_ALERT_FLAGS)
+  {
+    result = write16(statusReg & ~STATUS_ALERT_FLAGS, MAX17048_STATUS);
+    if (result)
+      return (result); // Write failed. Bail.
+  }
+
+  _alertTracking = true;
+  return (0);
+}
+
+uint8_t SFE_MAX1704X::disableAlertTracking()
+{
+  if (_device <= MAX1704X_MAX17044)
+  {
+    if (_printDebug == true)
+    {
+      _debugPort->println(F("disableAlertTracking: not supported on this device"));
+    }
+    return (MAX17043_GENERIC_ERROR);
+  }
+
+  _alertTracking = false;
+
+  // Open the window fully: VALRT.MIN = 0x00, VALRT.MAX = 0xFF. Both fields at once, so no read
+  uint8_t result = write16(0x00FF, MAX17048_CVALRT);
+  if (result)
+    return (result); // Write failed. Bail.
+
+  uint16_t configReg = read16(MAX17043_CONFIG);
+  if (configReg & MAX17043_CONFIG_ALSC)
+    result = write16(configReg & ~MAX17043_CONFIG_ALSC, MAX17043_CONFIG);
+  return (result);
+}
+
+uint8_t SFE_MAX1704X::serviceAlertTracking(uint8_t &status)
+{
+  status = 0;
+
+  if (_device <= MAX1704X_MAX17044)
+  {
+    if (_printDebug == true)
+    {
+      _debugPort->println(F("serviceAlertTracking: not supported on this device"));
+    }
+    return (MAX17043_GENERIC_ERROR);
+  }
+
+  uint16_t block[MAX1704X_REGISTER_BLOCK_LENGTH];
+  uint8_t result = readRegisters(MAX1704X_REGISTER_BLOCK_START, block, MAX1704X_REGISTER_BLOCK_LENGTH);
+  if (result)
+    return (result);
+
+  uint16_t statusReg = block[REGISTER_BLOCK_INDEX(MAX17048_STATUS)];
+  status = (statusReg >> 8) & 0x7F;
+
+  if (_alertTracking)
+  {
+    result = centerAlertWindow(block[REGISTER_BLOCK_INDEX(MAX17043_VCELL)], block[REGISTER_BLOCK_INDEX(MAX17048_CVALRT)]);
+    if (result)
+      return (result); // Write failed. Bail.
+  }
+
+  if (statusReg & STATUS_ALERT_FLAGS)
+  {
+    result = write16(statusReg & ~STATUS_ALERT_FLAGS, MAX17048_STATUS);
+    if (result)
+      return (result); // Write failed. Bail.
+  }
+
+  uint16_t configReg = block[REGISTER_BLOCK_INDEX(MAX17043_CONFIG)];
+  if (configReg & MAX17043_CONFIG_ALERT)
+    result = write16(configReg & ~MAX17043_CONFIG_ALERT, MAX17043_CONFIG);
+
+  return (result);
+}
+
+// Compute the configuration fingerprint (PRIVATE)
+// This is a 32-bit FNV-1a hash of the configured bits.
+uint32_t SFE_MAX1704X::computeFingerprint(const uint16_t *block)
+{
+  uint16_t words[5];
+  uint8_t numWords = 1;
+
+  // CONFIG LSB: ALSC and ATHD. SLEEP and ALRT are state, not configuration
+  words[0] = block[CONFIG_BLOCK_INDEX(MAX17043_CONFIG)] & 0x005F;
+
+  if (_device > MAX1704X_MAX17044)
+  {
+    words[1] = block[CONFIG_BLOCK_INDEX(MAX17048_CVALRT)];
+    words[2] = block[CONFIG_BLOCK_INDEX(MAX17048_HIBRT)];
+    words[3] = block[CONFIG_BLOCK_INDEX(MAX17048_VRESET_ID)];
+    words[4] = block[CONFIG_BLOCK_INDEX(MAX17048_STATUS)] & MAX1704x_STATUS_EnVR;
+    numWords = 5;
+  }
+
+  uint32_t hash = 2166136261UL; // FNV offset basis
+  for (uint8_t i = 0; i < numWords; i++)
+  {
+    hash = (hash ^ (words[i] >> 8)) * 16777619UL; // FNV prime
+    hash = (hash ^ (words[i] & 0xFF)) * 16777619UL;
+  }
+  return (hash);
+}
+
+uint8_t SFE_MAX1704X::getConfigFingerprint(uint32_t &fingerprint)
+{
+  uint16_t block[MAX1704X_CONFIG_BLOCK_LENGTH];
+
+  uint8_t result = readConfigBlock(block);
+  if (result)
+    return (result);
+
+  fingerprint = computeFingerprint(block);
+  return (0);
+}
+
+boolean SFE_MAX1704X::resumeIfConfigured(uint32_t fingerprint)
+{
+  uint16_t block[MAX1704X_CONFIG_BLOCK_LENGTH];
+
+  if (readConfigBlock(block) > 0)
+    return (false);
+
+  if ((_device > MAX1704X_MAX17044) && ((block[CONFIG_BLOCK_INDEX(MAX17048_STATUS)] >> 8) & MAX1704x_STATUS_RI))
+  {
+    if (_printDebug == true)
+    {
+      _debugPort->println(F("resumeIfConfigured: RI is set. The IC has been reset"));
+    }
+    return (false);
+  }
+
+  if (computeFingerprint(block) != fingerprint)
+    return (false);
+
+  // The configuration is kept, so pick up the power state from the block already read.
+  // Otherwise the next setPowerState would restore the POR HIBRT over the thresholds we just checked
+  setTrackedPowerState(MAX1704X_POWER_UNKNOWN);
+  if (block[CONFIG_BLOCK_INDEX(MAX17043_CONFIG)] & MAX17043_CONFIG_SLEEP)
+    setTrackedPowerState(MAX1704X_POWER_SLEEP);
+  if (_device > MAX1704X_MAX17044)
+    hibrtWritten(block[CONFIG_BLOCK_INDEX(MAX17048_HIBRT)]);
+  else if (_powerState == MAX1704X_POWER_UNKNOWN)
+    setTrackedPowerState(MAX1704X_POWER_ACTIVE);
+  return (true);
+}
+
+// Is a field present on this device? (PRIVATE)
+boolean SFE_MAX1704X::fieldSupported(boolean max17048Only)
+{
+  if (max17048Only && (_device <= MAX1704X_MAX17044))
+  {
+    if (_printDebug == true)
+    {
+      _debugPort->println(F("getField/setField: not supported on this device"));
+    }
+    return (false);
+  }
+  return (true);
+}
+
+// Read-modify-write the bits [mask] of register [address] (PRIVATE)
+// If [mask] covers the whole register, the read is skipped.
+uint8_t SFE_MAX1704X::writeField(uint8_t address, uint16_t mask, uint8_t shift, uint16_t value)
+{
+  uint16_t reg = 0;
+  if (mask != 0xFFFF)
+    reg = read16(address) & ~mask; // Read the register, so we don't modify any other fields
+  reg |= (value << shift) & mask;
+
+  uint8_t result = write16(reg, address);
+  if (result)
+    return (result);
+
+  // Keep the tracked power state in step with the fields which change it
+  if (address == MAX17048_HIBRT)
+  {
+    hibrtWritten(reg);
+  }
+  else if ((address == MAX17043_CONFIG) && (mask & MAX17043_CONFIG_SLEEP))
+  {
+    invalidateCache();
+    if (reg & MAX17043_CONFIG_SLEEP)
+    {
+      // On the MAX17048/49 the IC only sleeps if EnSleep is set too
+      if ((_device <= MAX1704X_MAX17044) || _enSleepSet)
+        setTrackedPowerState(MAX1704X_POWER_SLEEP);
+      else
+        setTrackedPowerState(MAX1704X_POWER_UNKNOWN);
+    }
+    else
+    {
+      sleepCleared();
+    }
+  }
+  else if ((address == MAX17043_MODE) && (mask & MAX17048_MODE_ENSLEEP))
+  {
+    invalidateCache();
+    _enSleepSet = (reg & MAX17048_MODE_ENSLEEP) > 0;
+    if ((_enSleepSet == false) && (_powerState == MAX1704X_POWER_SLEEP))
+      setTrackedPowerState(MAX1704X_POWER_UNKNOWN); // CONFIG.SLEEP alone does not keep the IC asleep
+  }
+  return (0);
+}
+
+uint8_t SFE_MAX1704X::write16(uint16_t data, uint8_t address)
+{
+  uint8_t msb, lsb;
+  msb = (data & 0xFF00) >> 8;
+  lsb = (data & 0x00FF);
+  _i2cPort->beginTransmission(MAX1704x_ADDRESS);
+  _i2cPort->write(address);
+  _i2cPort->write(msb);
+  _i2cPort->write(lsb);
+  _busTransactions++;
+  _busBytes += 4;
+  return (_i2cPort->endTransmission());
+}
+
+uint16_t SFE_MAX1704X::read16(uint8_t address)
+{
+  uint8_t msb, lsb;
+  int16_t timeout = 1000;
+
+  _i2cPort->beginTransmission(MAX1704x_ADDRESS);
+  _i2cPort->write(address);
+  _i2cPort->endTransmission(false);
+
+  _i2cPort->requestFrom(MAX1704x_ADDRESS, 2);
+  _busTransactions++;
+  _busBytes += 5;
+  while ((_i2cPort->available() < 2) && (timeout-- > 0))
+    delay(1);
+  msb = _i2cPort->read();
+  lsb = _i2cPort->read();
+
+  return ((uint16_t)msb << 8) | lsb;
+}
+
+uint8_t SFE_MAX1704X::readRegisters(uint8_t address, uint16_t *data, uint8_t numRegisters)
+{
+  _i2cPort->beginTransmission(MAX1704x_ADDRESS);
+  _i2cPort->write(address);
+  uint8_t result = _i2cPort->endTransmission(false);
+  _busTransactions++;
+  _busBytes += 2;
+  if (result)
+    return (result); // Address NACK'd. Bail.
+
+  uint8_t numBytes = numRegisters * 2;
+  _busBytes += 1 + numBytes;
+  if (_i2cPort->requestFrom((uint8_t)MAX1704x_ADDRESS, numBytes) != numBytes)
+    return (MAX17043_GENERIC_ERROR);
+
+  for (uint8_t i = 0; i < numRegisters; i++)
+  {
+    uint8_t msb = _i2cPort->read();
+    uint8_t lsb = _i2cPort->read();
+    data[i] = ((uint16_t)msb << 8) | lsb;
+  }
+
+  return (0);
+}
+
+SFE_MAX1704X_StagedWrite::SFE_MAX1704X_StagedWrite(SFE_MAX1704X &gauge)
+{
+  _gauge = &gauge;
+  clear();
+}
+
+void SFE_MAX1704X_StagedWrite::clear()
+{
+  _numRegisters = 0;
+}
+
+// Merge [bits] into the staged value for [address] (PRIVATE)
+boolean SFE_MAX1704X_StagedWrite::stageBits(uint8_t address, uint16_t mask, uint16_t bits)
+{
+  uint8_t i;
+  for (i = 0; i < _numRegisters; i++)
+  {
+    if (_address[i] == address)
+      break;
+  }
+
+  if (i == _numRegisters)
+  {
+    if (_numRegisters >= MAX1704X_STAGED_REGISTERS)
+      return (false);
+    _address[i] = address;
+    _mask[i] = 0;
+    _bits[i] = 0;
+    _numRegisters++;
+  }
+
+  _mask[i] |= mask;
+  _bits[i] = (_bits[i] & ~mask) | bits;
+  return (true);
+}
+
+uint8_t SFE_MAX1704X_StagedWrite::commit()
+{
+  uint8_t result = 0;
+
+  for (uint8_t i = 0; i < _numRegisters; i++)
+  {
+    // writeField skips the read if the whole register is staged
+    result = _gauge->writeField(_address[i], _mask[i], 0, _bits[i]);
+    if (result)
+      break; // Write failed. Bail.
+  }
+
+  clear();
+  return (result);
+}
+
+SFE_MAX1704X_ReportFilter::SFE_MAX1704X_ReportFilter(uint16_t vcellDeadband, uint16_t socDeadband, uint16_t crateDeadband, unsigned long maxSilenceMillis)
+{
+  setDeadbands(vcellDeadband, socDeadband, crateDeadband);
+  setMaxSilence(maxSilenceMillis);
+  reset();
+  resetCounters();
+}
+
+void SFE_MAX1704X_ReportFilter::setDeadbands(uint16_t vcellDeadband, uint16_t socDeadband, uint16_t crateDeadband)
+{
+  _vcellDeadband = vcellDeadband;
+  _socDeadband = socDeadband;
+  _crateDeadband = crateDeadband;
+}
+
+void SFE_MAX1704X_ReportFilter::setMaxSilence(unsigned long maxSilenceMillis)
+{
+  _maxSilenceMillis = maxSilenceMillis;
+}
+
+void SFE_MAX1704X_ReportFilter::reset()
+{
+  _haveReference = false;
+}
+
+void SFE_MAX1704X_ReportFilter::resetCounters()
+{
+  _reported = 0;
+  _suppressed = 0;
+}
+
+boolean SFE_MAX1704X_ReportFilter::check(const sfe_max1704x_snapshot_t &snapshot)
+{
+  boolean report = !_haveReference;
+
+  if (!report)
+  {
+    // Compare in 32 bits so large swings can not wrap
+    int32_t dVcell = (int32_t)snapshot.vcell - (int32_t)_reference.vcell;
+    int32_t dSoc = (int32_t)snapshot.soc - (int32_t)_reference.soc;
+    int32_t dCrate = (int32_t)snapshot.crate - (int32_t)_reference.crate;
+
+    report = (abs(dVcell) > _vcellDeadband) || (abs(dSoc) > _socDeadband) || (abs(dCrate) > _crateDeadband);
+
+    // Alerts are always reported
+    if ((snapshot.status != _reference.status) || ((snapshot.config ^ _reference.config) & MAX17043_CONFIG_ALERT))
+      report = true;
+
+    if ((_maxSilenceMillis > 0) && ((snapshot.millis - _reference.millis) >= _maxSilenceMillis))
+      report = true;
+  }
+
+  if (report)
+  {
+    _reference = snapshot;
+    _haveReference = true;
+    _reported++;
+  }
+  else
+  {
+    _suppressed++;
+  }
+
+  return (report);
+}
+
+SFE_MAX1704X_HibernateAdvisor::SFE_MAX1704X_HibernateAdvisor(float maxLag, uint8_t maxActThr)
+{
+  // The fastest |CRATE| (%/hr) which keeps the lag within maxLag over one hibernate conversion
+  float maxRate = maxLag * 3600.0 / MAX1704X_ADVISOR_CONVERSION_SECONDS;
+  float hibThr = maxRate / 0.208;
+  if (hibThr < 1.0)
+    hibThr = 1.0;
+  if (hibThr > 255.0)
+    hibThr = 255.0;
+  _hibThr = (uint8_t)hibThr;
+  _maxActThr = (maxActThr > 0) ? maxActThr : 1;
+  reset();
+}
+
+void SFE_MAX1704X_HibernateAdvisor::reset()
+{
+  for (uint8_t i = 0; i <= MAX1704X_ADVISOR_BINS; i++)
+    _dVcellHistogram[i] = 0;
+  _havePrevious = false;
+  _samples = 0;
+  _hibernating = 0;
+}
+
+// Count a sample in [bin]. Halve every bin before a count would overflow,
+// which also gives more weight to recent history (PRIVATE)
+void SFE_MAX1704X_HibernateAdvisor::addToHistogram(uint16_t *histogram, uint8_t bin)
+{
+  if (histogram[bin] == 0xFFFF)
+  {
+    for (uint8_t i = 0; i <= MAX1704X_ADVISOR_BINS; i++)
+      histogram[i] >>= 1;
+  }
+  histogram[bin]++;
+}
+
+void SFE_MAX1704X_HibernateAdvisor::add(const sfe_max1704x_snapshot_t &snapshot)
+{
+  if (snapshot.device <= MAX1704X_MAX17044)
+    return;
+
+  _samples++;
+  if (snapshot.mode & MAX17048_MODE_HIBSTAT)
+    _hibernating++;
+
+  uint16_t rate = (snapshot.crate < 0) ? -(int32_t)snapshot.crate : snapshot.crate;
+
+  // Only the quiet samples tell us how much VCELL moves while the IC could be hibernating
+  if (_havePrevious && (rate < _hibThr))
+  {
+    uint16_t delta = (snapshot.vcell > _previousVcell) ? snapshot.vcell - _previousVcell : _previousVcell - snapshot.vcell;
+    uint16_t dBin = delta / MAX1704X_ADVISOR_DVCELL_BIN;
+    if (dBin > MAX1704X_ADVISOR_BINS)
+      dBin = MAX1704X_ADVISOR_BINS;
+    addToHistogram(_dVcellHistogram, dBin);
+  }
+  _previousVcell = snapshot.vcell;
+  _havePrevious = true;
+}
+
+float SFE_MAX1704X_HibernateAdvisor::getHibernateFraction()
+{
+  if (_samples == 0)
+    return (0.0);
+  return ((float)_hibernating / (float)_samples);
+}
+
+uint16_t SFE_MAX1704X_HibernateAdvisor::percentile99(const uint16_t *histogram, uint8_t numBins)
+{
+  uint32_t total = 0;
+  for (uint8_t i = 0; i < numBins; i++)
+    total += histogram[i];
+  if (total == 0)
+    return (0);
+
+  uint32_t target = total - (total / 100); // Samples at or below the 99th percentile
+  uint32_t count = 0;
+  uint8_t i;
+  for (i = 0; i < numBins - 1; i++)
+  {
+    count += histogram[i];
+    if (count >= target)
+      break;
+  }
+  return (i + 1); // Upper edge, in bins
+}
+
+uint8_t SFE_MAX1704X_HibernateAdvisor::getRecommendedActThr()
+{
+  uint16_t edge = percentile99(_dVcellHistogram, MAX1704X_ADVISOR_BINS + 1);
+  if (edge == 0)
+    return ((_maxActThr < 0x30) ? _maxActThr : 0x30); // No samples: the POR default
+  // VCELL LSbs to ActThr LSbs: 78.125uV vs 1.25mV
+  uint16_t threshold = ((uint32_t)edge * MAX1704X_ADVISOR_DVCELL_BIN) / 16;
+  if (threshold > _maxActThr)
+    threshold = _maxActThr;
+  return (threshold);
+}
+
+uint8_t SFE_MAX1704X_HibernateAdvisor::apply(SFE_MAX1704X &gauge)
+{
+  if (_samples == 0)
+    return (MAX17043_GENERIC_ERROR);
+
+  SFE_MAX1704X_StagedWrite changes(gauge);
+  if (!changes.stage<MAX1704X_FIELD_HIBRT_HIBTHR>(getRecommendedHibThr()) || !changes.stage<MAX1704X_FIELD_HIBRT_ACTTHR>(getRecommendedActThr()))
+    return (MAX17043_GENERIC_ERROR); // Not a MAX17048/49
+  return (changes.commit()); // Both fields: a single write of HIBRT
+}
+
+// SFE_MAX1704X_FrozenWatchdog recovery steps
+#define WATCHDOG_STEP_QUICK_START 0
+#define WATCHDOG_STEP_RESET 1
+#define WATCHDOG_STEP_VERIFY 2
+#define WATCHDOG_STEP_EXHAUSTED 3
+
+SFE_MAX1704X_FrozenWatchdog::SFE_MAX1704X_FrozenWatchdog(SFE_MAX1704X &gauge, const sfe_max1704x_profile_t *profile, unsigned long windowMillis, uint16_t activityThreshold)
+{
+  _gauge = &gauge;
+  _profile = profile;
+  _windowMillis = windowMillis;
+  _activityThreshold = activityThreshold;
+  _recoveries = 0;
+  reset();
+}
+
+void SFE_MAX1704X_FrozenWatchdog::reset()
+{
+  _haveReference = false;
+  _activity = false;
+  _step = WATCHDOG_STEP_QUICK_START;
+}
+
+sfe_max1704x_watchdog_action_e SFE_MAX1704X_FrozenWatchdog::check(const sfe_max1704x_snapshot_t &snapshot, boolean externalActivity)
+{
+  if (_step == WATCHDOG_STEP_VERIFY)
+  {
+    // A POR was issued at the previous check. It sets RI (MAX17048/49 only).
+    // RI is taken from the snapshot, so STATUS is only written to clear it
+    uint8_t result = 0;
+    if (snapshot.device > MAX1704X_MAX17044)
+    {
+      if (snapshot.status & (MAX1704x_STATUS_RI << 8))
+        result = _gauge->write16(snapshot.status & ~(MAX1704x_STATUS_RI << 8), MAX17048_STATUS);
+      else
+        result = MAX17043_GENERIC_ERROR;
+    }
+    if ((result == 0) && (_profile != NULL))
+      result = _gauge->applyProfile(*_profile);
+
+    _step = WATCHDOG_STEP_EXHAUSTED;
+    _haveReference = false; // The IC restarted: the next snapshot becomes the reference
+    _recoveries++;
+    return (result ? MAX1704X_WATCHDOG_FAILED : MAX1704X_WATCHDOG_REAPPLY_PROFILE);
+  }
+
+  if (!_haveReference || (snapshot.vcell != _vcell) || (snapshot.soc != _soc))
+  {
+    if (_haveReference)
+      _step = WATCHDOG_STEP_QUICK_START; // A change: the gauge is alive
+    _haveReference = true;
+    _vcell = snapshot.vcell;
+    _soc = snapshot.soc;
+    _lastChange = snapshot.millis;
+    _activity = false;
+    return (MAX1704X_WATCHDOG_NONE);
+  }
+
+  int32_t rate = snapshot.crate;
+  if (externalActivity || (abs(rate) >= _activityThreshold))
+    _activity = true;
+
+  if (!_activity || ((snapshot.millis - _lastChange) < _windowMillis))
+    return (MAX1704X_WATCHDOG_NONE);
+
+  // Frozen. Give the next step a full window
+  _lastChange = snapshot.millis;
+  _activity = false;
+
+  if (_step == WATCHDOG_STEP_QUICK_START)
+  {
+    _gauge->quickStart();
+    _step = WATCHDOG_STEP_RESET;
+    _recoveries++;
+    return (MAX1704X_WATCHDOG_QUICK_START);
+  }
+  if (_step == WATCHDOG_STEP_RESET)
+  {
+    _gauge->reset(); // The IC does not ACK the POR command
+    _step = WATCHDOG_STEP_VERIFY;
+    _recoveries++;
+    return (MAX1704X_WATCHDOG_RESET);
+  }
+  return (MAX1704X_WATCHDOG_FAILED);
+}
+
+SFE_MAX1704X_RegisterView::SFE_MAX1704X_RegisterView(const uint8_t *bytes, uint8_t numBytes, uint8_t startAddress, sfe_max1704x_devices_e device)
+{
+  _bytes = bytes;
+  _numBytes = numBytes;
+  _startAddress = startAddress;
+  _device = device;
+}
+
+boolean SFE_MAX1704X_RegisterView::contains(uint8_t address)
+{
+  if (address < _startAddress)
+    return (false);
+  return ((address - _startAddress + 2) <= _numBytes);
+}
+
+uint16_t SFE_MAX1704X_RegisterView::getRegister(uint8_t address)
+{
+  if (!contains(address))
+    return (0);
+  const uint8_t *word = _bytes + (address - _startAddress);
+  return (((uint16_t)word[0] << 8) | word[1]);
+}
+
+float SFE_MAX1704X_RegisterView::getVoltage()
+{
+  return SFE_MAX1704X::convertVoltage(getRegister(MAX17043_VCELL), _device);
+}
+
+float SFE_MAX1704X_RegisterView::getSOC()
+{
+  return SFE_MAX1704X::convertSOC(getRegister(MAX17043_SOC));
+}
+
+float SFE_MAX1704X_RegisterView::getChangeRate()
+{
+  if (_device <= MAX1704X_MAX17044)
+    return (0.0);
+  return SFE_MAX1704X::convertChangeRate((int16_t)getRegister(MAX17048_CRATE));
+}
+
+uint8_t SFE_MAX1704X_RegisterView::getStatus()
+{
+  if (_device <= MAX1704X_MAX17044)
+    return (0);
+  return ((getRegister(MAX17048_STATUS) >> 8) & 0x7F); //Highest bit is don't care
+}
+
+void SFE_MAX1704X_LogBlock::writeHeader(const sfe_max1704x_log_header_t &header, uint8_t *bytes)
+{
+  bytes[0] = MAX1704X_LOG_MAGIC >> 8;
+  bytes[1] = MAX1704X_LOG_MAGIC & 0xFF;
+  bytes[2] = MAX1704X_LOG_VERSION;
+  bytes[3] = header.numSamples;
+  bytes[4] = header.firstTimestamp >> 24;
+  bytes[5] = header.firstTimestamp >> 16;
+  bytes[6] = header.firstTimestamp >> 8;
+  bytes[7] = header.firstTimestamp;
+  bytes[8] = header.lastTimestamp >> 24;
+  bytes[9] = header.lastTimestamp >> 16;
+  bytes[10] = header.lastTimestamp >> 8;
+  bytes[11] = header.lastTimestamp;
+  bytes[12] = header.minVcell >> 8;
+  bytes[13] = header.minVcell;
+  bytes[14] = header.maxVcell >> 8;
+  bytes[15] = header.maxVcell;
+  bytes[16] = header.minSOC >> 8;
+  bytes[17] = header.minSOC;
+  bytes[18] = header.maxSOC >> 8;
+  bytes[19] = header.maxSOC;
+  bytes[20] = (uint16_t)header.minCrate >> 8;
+  bytes[21] = (uint16_t)header.minCrate;
+  bytes[22] = (uint16_t)header.maxCrate >> 8;
+  bytes[23] = (uint16_t)header.maxCrate;
+  bytes[24] = header.status >> 8;
+  bytes[25] = header.status;
+}
+
+uint8_t SFE_MAX1704X_LogBlock::parseHeader(const uint8_t *bytes, uint16_t length, sfe_max1704x_log_header_t &header)
+{
+  if ((length < MAX1704X_LOG_HEADER_LENGTH) || (bytes[0] != (MAX1704X_LOG_MAGIC >> 8)) || (bytes[1] != (MAX1704X_LOG_MAGIC & 0xFF)) || (bytes[2] != MAX1704X_LOG_VERSION) || (bytes[3] == 0))
+    return (MAX17043_GENERIC_ERROR);
+
+  header.numSamples = bytes[3];
+  header.firstTimestamp = ((uint32_t)bytes[4] << 24) | ((uint32_t)bytes[5] << 16) | ((uint32_t)bytes[6] << 8) | bytes[7];
+  header.lastTimestamp = ((uint32_t)bytes[8] << 24) | ((uint32_t)bytes[9] << 16) | ((uint32_t)bytes[10] << 8) | bytes[11];
+  header.minVcell = ((uint16_t)bytes[12] << 8) | bytes[13];
+  header.maxVcell = ((uint16_t)bytes[14] << 8) | bytes[15];
+  header.minSOC = ((uint16_t)bytes[16] << 8) | bytes[17];
+  header.maxSOC = ((uint16_t)bytes[18] << 8) | bytes[19];
+  header.minCrate = (int16_t)(((uint16_t)bytes[20] << 8) | bytes[21]);
+  header.maxCrate = (int16_t)(((uint16_t)bytes[22] << 8) | bytes[23]);
+  header.status = ((uint16_t)bytes[24] << 8) | bytes[25];
+
+  return (0);
+}
+
+uint16_t SFE_MAX1704X_LogBlock::getLength(const sfe_max1704x_log_header_t &header)
+{
+  return (MAX1704X_LOG_HEADER_LENGTH + ((uint16_t)header.numSamples * MAX1704X_LOG_SAMPLE_LENGTH));
+}
+
+boolean SFE_MAX1704X_LogBlock::overlaps(const sfe_max1704x_log_header_t &header, uint32_t fromTimestamp, uint32_t toTimestamp)
+{
+  if (header.lastTimestamp < header.firstTimestamp) // Wrapped: first..0xFFFFFFFF then 0..last
+    return ((header.firstTimestamp <= toTimestamp) || (header.lastTimestamp >= fromTimestamp));
+  return ((header.firstTimestamp <= toTimestamp) && (header.lastTimestamp >= fromTimestamp));
 }
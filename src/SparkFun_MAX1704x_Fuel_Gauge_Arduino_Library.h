@@ -100,6 +100,97 @@ typedef enum {
 #define MAX17048_HIBRT_ENHIB 0xFFFF // always use hibernate mode
 #define MAX17048_HIBRT_DISHIB 0x0000 // disable hibernate mode
 
+/////////////////////////////////////
+// MAX1704x ADC Conversion Periods //
+/////////////////////////////////////
+// VCELL, SOC and CRATE only change when the IC completes a conversion.
+// These periods are used by the measurement cache (see enableCache).
+#define MAX17043_UPDATE_PERIOD_MS 500 // MAX17043/44 update VCELL and SOC every 500ms
+#define MAX17048_UPDATE_PERIOD_ACTIVE_MS 250 // MAX17048/49 convert every 250ms in active mode
+#define MAX17048_UPDATE_PERIOD_HIBERNATE_MS 45000 // MAX17048/49 convert every 45s in hibernate mode
+
+///////////////////////////////
+// MAX1704x Power State Enum //
+///////////////////////////////
+
+typedef enum {
+  MAX1704X_POWER_UNKNOWN = 0,    // Not yet known: no transition has been made since begin() or reset()
+  MAX1704X_POWER_ACTIVE,         // Awake. On the MAX17048/49 hibernate is disabled (HIBRT = 0x0000)
+  MAX1704X_POWER_HIBERNATE,      // (MAX17048/49) Hibernate is forced (HIBRT = 0xFFFF)
+  MAX1704X_POWER_AUTO_HIBERNATE, // (MAX17048/49) The IC enters and exits hibernate using the HIBRT thresholds
+  MAX1704X_POWER_SLEEP           // Asleep (CONFIG.SLEEP is set)
+} sfe_max1704x_power_state_e;
+
+//////////////////////////////////
+// MAX1704x Configuration Block //
+//////////////////////////////////
+// The configuration registers of the MAX17048/49 all lie between HIBRT (0x0A)
+// and STATUS (0x1A), so they can be read in a single burst.
+// 0x0E-0x13 are reserved and are read but never written.
+#define MAX1704X_CONFIG_BLOCK_START MAX17048_HIBRT
+#define MAX1704X_CONFIG_BLOCK_LENGTH 9 // Registers (not bytes)
+
+/////////////////////////////
+// MAX1704x Register Block //
+/////////////////////////////
+// All registers from VCELL (0x02) to STATUS (0x1A) can be read in a single
+// 26-byte burst, which fits in the 32-byte Wire buffer.
+#define MAX1704X_REGISTER_BLOCK_START MAX17043_VCELL
+#define MAX1704X_REGISTER_BLOCK_LENGTH 13 // Registers (not bytes)
+
+//////////////////////////////
+// MAX1704x Register Fields //
+//////////////////////////////
+// Every configuration and status field, described by MAX1704X_FIELDS below.
+// The order must match MAX1704X_FIELDS.
+typedef enum {
+  MAX1704X_FIELD_ATHD = 0,        // CONFIG: empty alert threshold, (32 - ATHD)%
+  MAX1704X_FIELD_ALRT,            // CONFIG: alert flag
+  MAX1704X_FIELD_ALSC,            // CONFIG: (MAX17048/49) SOC change alert enable
+  MAX1704X_FIELD_SLEEP,           // CONFIG: sleep
+  MAX1704X_FIELD_RCOMP,           // CONFIG: ModelGauge compensation
+  MAX1704X_FIELD_HIBSTAT,         // MODE: (MAX17048/49) hibernating (read only)
+  MAX1704X_FIELD_ENSLEEP,         // MODE: (MAX17048/49) sleep enable
+  MAX1704X_FIELD_HIBRT_ACTTHR,    // HIBRT: (MAX17048/49) active threshold
+  MAX1704X_FIELD_HIBRT_HIBTHR,    // HIBRT: (MAX17048/49) hibernate threshold
+  MAX1704X_FIELD_VALRT_MAX,       // CVALRT: (MAX17048/49) voltage alert maximum
+  MAX1704X_FIELD_VALRT_MIN,       // CVALRT: (MAX17048/49) voltage alert minimum
+  MAX1704X_FIELD_ID,              // VRESET/ID: (MAX17048/49) factory ID (read only)
+  MAX1704X_FIELD_COMPARATOR_DIS,  // VRESET/ID: (MAX17048/49) disable the analog comparator
+  MAX1704X_FIELD_VRESET,          // VRESET/ID: (MAX17048/49) reset voltage
+  MAX1704X_FIELD_STATUS_FLAGS,    // STATUS: (MAX17048/49) RI, VH, VL, VR, HD, SC. See MAX1704x_STATUS_RI etc.
+  MAX1704X_FIELD_ENVR,            // STATUS: (MAX17048/49) voltage reset alert enable
+  MAX1704X_NUM_FIELDS
+} sfe_max1704x_field_e;
+
+typedef struct
+{
+  uint8_t address;       // Register address
+  uint16_t mask;         // Aligned mask of the field within the register
+  uint8_t shift;         // Shift to right-align the field
+  float lsb;             // Real-world value of one LSb (0 if not applicable)
+  boolean max17048Only;  // Only present on the MAX17048/49
+} sfe_max1704x_field_t;
+
+static constexpr sfe_max1704x_field_t MAX1704X_FIELDS[MAX1704X_NUM_FIELDS] = {
+  {MAX17043_CONFIG, 0x001F, 0, 1.0, false},        // ATHD: 1%
+  {MAX17043_CONFIG, 0x0020, 5, 0.0, false},        // ALRT
+  {MAX17043_CONFIG, 0x0040, 6, 0.0, true},         // ALSC
+  {MAX17043_CONFIG, 0x0080, 7, 0.0, false},        // SLEEP
+  {MAX17043_CONFIG, 0xFF00, 8, 0.0, false},        // RCOMP
+  {MAX17043_MODE, 0x1000, 12, 0.0, true},          // HIBSTAT
+  {MAX17043_MODE, 0x2000, 13, 0.0, true},          // EnSleep
+  {MAX17048_HIBRT, 0x00FF, 0, 0.00125, true},      // ActThr: 1.25mV
+  {MAX17048_HIBRT, 0xFF00, 8, 0.208, true},        // HibThr: 0.208%/hr
+  {MAX17048_CVALRT, 0x00FF, 0, 0.02, true},        // VALRT.MAX: 20mV per cell
+  {MAX17048_CVALRT, 0xFF00, 8, 0.02, true},        // VALRT.MIN: 20mV per cell
+  {MAX17048_VRESET_ID, 0x00FF, 0, 0.0, true},      // ID
+  {MAX17048_VRESET_ID, 0x0100, 8, 0.0, true},      // Dis
+  {MAX17048_VRESET_ID, 0xFE00, 9, 0.04, true},     // VRESET: 40mV
+  {MAX17048_STATUS, 0x3F00, 8, 0.0, true},         // RI..SC
+  {MAX17048_STATUS, MAX1704x_STATUS_EnVR, 14, 0.0, true}, // EnVR
+};
+
 ////////////////////////////////
 // MAX1704x 7-Bit I2C Address //
 ////////////////////////////////
@@ -115,17 +206,209 @@ typedef enum {
 // So, let's use "5" as a generic error value
 #define MAX17043_GENERIC_ERROR 5
 
+///////////////////////
+// MAX1704x Snapshot //
+///////////////////////
+// The raw measurement and status registers, read in a single burst by getSnapshot().
+// Use SFE_MAX1704X::convertVoltage etc. to convert to real units.
+typedef struct
+{
+  unsigned long millis;          // millis() when the snapshot was taken
+  sfe_max1704x_devices_e device; // Needed to interpret vcell
+  uint16_t vcell;                // VCELL. 78.125uV per cell per LSb (MAX17043/44: bits 3-0 are zero)
+  uint16_t soc;                  // SOC. 1/256% per LSb
+  int16_t crate;                 // (MAX17048/49) CRATE. 0.208%/hr per LSb. Zero on the MAX17043/44
+  uint16_t mode;                 // MODE. (MAX17048/49) Includes HIBSTAT
+  uint16_t config;               // CONFIG
+  uint16_t status;               // (MAX17048/49) STATUS. Zero on the MAX17043/44
+} sfe_max1704x_snapshot_t;
+
+/////////////////////////////
+// MAX1704x Snapshot Frame //
+/////////////////////////////
+// Fixed-layout binary encoding of a snapshot, used by serializeSnapshot and
+// deserializeSnapshot. All multi-byte values are big-endian:
+//   0: MAX1704X_FRAME_VERSION   1: device   2-5: millis
+//   6-7: VCELL   8-9: SOC   10-11: CRATE   12-13: MODE   14-15: CONFIG   16-17: STATUS
+#define MAX1704X_FRAME_VERSION 1
+#define MAX1704X_FRAME_LENGTH 18 // Bytes
+
+//////////////////////////////
+// MAX1704x Supply Currents //
+//////////////////////////////
+// Typical IC supply currents (uA), used by estimateAverageCurrent()
+#define MAX17043_CURRENT_ACTIVE_UA 50.0
+#define MAX17043_CURRENT_SLEEP_UA 1.0
+#define MAX17048_CURRENT_ACTIVE_UA 23.0
+#define MAX17048_CURRENT_HIBERNATE_UA 4.0
+#define MAX17048_CURRENT_SLEEP_UA 0.5
+
+//////////////////////////////
+// MAX1704x Channel Probing //
+//////////////////////////////
+// Callback used by probeChannels() to select a channel on an I2C mux
+typedef void (*sfe_max1704x_select_channel_t)(uint8_t channel);
+
+// The result of probing one mux channel
+typedef struct
+{
+  uint8_t channel;
+  boolean present;           // Did a gauge answer on this channel?
+  unsigned long selectMicros; // Time taken by selectChannel
+  unsigned long probeMicros;  // Time taken by probe
+} sfe_max1704x_probe_result_t;
+
+//////////////////////////
+// MAX1704x Alert Queue //
+//////////////////////////
+// Timestamps ALRT falling edges in an ISR and hands them to the loop.
+// A wait-free single-producer / single-consumer ring: capture() is the only
+// writer of _head and is called from the ISR; pop() is the only writer of _tail
+// and is called from the loop. N must be a power of two, at most 128.
+// One slot is kept empty, so up to N-1 edges can be queued.
+// Usage:
+//   SFE_MAX1704X_AlertQueue<8> alerts;
+//   void alertISR() { alerts.capture(); }
+//   attachInterrupt(digitalPinToInterrupt(ALRT_PIN), alertISR, FALLING);
+//   ... then in loop(): lipo.serviceAlerts(alerts, &event);
+template <uint8_t N>
+class SFE_MAX1704X_AlertQueue
+{
+  static_assert(N >= 2 && N <= 128 && (N & (N - 1)) == 0, "SFE_MAX1704X_AlertQueue: N must be a power of two from 2 to 128");
+
+public:
+  SFE_MAX1704X_AlertQueue()
+  {
+    _head = 0;
+    _tail = 0;
+    _overflows = 0;
+  }
+
+  // ISR side: record an edge, timestamped with micros()
+  void capture()
+  {
+    uint8_t head = _head;
+    uint8_t next = (head + 1) & (N - 1);
+    if (next == _tail)
+    {
+      _overflows++; // Full: drop the edge
+      return;
+    }
+    _timestamps[head] = micros();
+    _head = next; // Publish
+  }
+
+  // Loop side: true if at least one edge is queued
+  boolean available() { return (_head != _tail); }
+
+  // Loop side: remove the oldest edge
+  // Output: true if an edge was removed, false if the queue was empty
+  boolean pop(unsigned long &timestamp)
+  {
+    uint8_t tail = _tail;
+    if (tail == _head)
+      return (false);
+    timestamp = _timestamps[tail];
+    _tail = (tail + 1) & (N - 1); // Release the slot
+    return (true);
+  }
+
+  // Edges dropped because the queue was full
+  uint8_t getOverflows() { return (_overflows); }
+
+private:
+  volatile unsigned long _timestamps[N];
+  volatile uint8_t _head;
+  volatile uint8_t _tail;
+  volatile uint8_t _overflows;
+};
+
+// A burst of ALRT edges, serviced with a single register read (see serviceAlerts)
+typedef struct
+{
+  uint8_t edges;               // Number of edges in the burst
+  unsigned long firstMicros;   // Timestamp of the first edge
+  unsigned long lastMicros;    // Timestamp of the last edge
+  unsigned long latencyMicros; // From the first edge until the alert had been read and cleared
+  uint8_t status;              // MAX17048/49: the 7 STATUS bits (see getStatus). MAX17043/44: 1 if ALRT was set
+  uint8_t result;              // 0 if the alert was serviced, positive integer if a read or write failed
+} sfe_max1704x_alert_event_t;
+
+///////////////////////////
+// MAX1704x Reset Timing //
+///////////////////////////
+// How long each phase of resetAndWait() took
+typedef struct
+{
+  unsigned long commandMicros;  // Issuing the POR command
+  unsigned long reappearMicros; // From the POR command until the IC answered again
+  unsigned long readyMicros;    // From the IC answering until VCELL and SOC were valid
+  unsigned long totalMicros;
+} sfe_max1704x_reset_timing_t;
+
+////////////////////////////////////
+// MAX1704x Configuration Profile //
+////////////////////////////////////
+// A complete gauge configuration, applied in one go by applyProfile().
+// Fields marked (MAX17048/49) are ignored on the MAX17043/44.
+typedef struct
+{
+  uint8_t threshold;          // Empty alert threshold: 1-32%. See setThreshold
+  uint8_t compensation;       // RCOMP. See setCompensation
+  boolean socAlert;           // (MAX17048/49) 1% SOC change alert. See enableSOCAlert
+  uint8_t valrtMax;           // (MAX17048/49) LSb = 20mV. See setVALRTMax
+  uint8_t valrtMin;           // (MAX17048/49) LSb = 20mV. See setVALRTMin
+  uint8_t hibrtActThr;        // (MAX17048/49) LSb = 1.25mV. See setHIBRTActThr
+  uint8_t hibrtHibThr;        // (MAX17048/49) LSb = 0.208%/hr. See setHIBRTHibThr
+  uint8_t resetVoltage;       // (MAX17048/49) 7-bit, LSb = 40mV. See setResetVoltage
+  boolean comparator;         // (MAX17048/49) VRESET analog comparator enabled. See enableComparator
+  boolean voltageResetAlert;  // (MAX17048/49) EnVR. See enableAlert
+} sfe_max1704x_profile_t;
+
+class SFE_MAX1704X_StagedWrite;
+
 class SFE_MAX1704X
 {
+  friend class SFE_MAX1704X_StagedWrite;
+
 public:
   SFE_MAX1704X(sfe_max1704x_devices_e device = MAX1704X_MAX17043); // Default to the 5V MAX17043
 
   // begin() - Initializes the MAX17043.
-  boolean begin(TwoWire &wirePort = Wire); //Returns true if module is detected
+  // If [autoDetect] is true, detectDevice() is called to check the device
+  // family passed to the constructor.
+  boolean begin(TwoWire &wirePort = Wire, boolean autoDetect = false); //Returns true if module is detected
+
+  // detectDevice() - Identify the MAX17043/44 or MAX17048/49 family from
+  // VERSION and the MAX17048/49-only registers (CVALRT, CRATE, VRESET/ID and
+  // STATUS), read in a single burst. A VERSION other than 0x001_ means a
+  // MAX17043/44. As some MAX17043/44 also report 0x001_, that case is settled
+  // by the contents of the MAX17048/49-only registers, which are reserved on
+  // the MAX17043/44. The cell count (1 or 2) passed to the constructor is kept:
+  // e.g. a MAX17044 which turns out to be a MAX17048/49 becomes a MAX17049.
+  // The result is cached. Later calls do not access the bus.
+  // Output: the (possibly updated) device type.
+  sfe_max1704x_devices_e detectDevice();
+
+  // getDevice() - Return the device type currently in use.
+  sfe_max1704x_devices_e getDevice();
 
   //Returns true if device answers on MAX1704x_ADDRESS
   boolean isConnected(void);
 
+  // probe() - Returns true if device answers on MAX1704x_ADDRESS.
+  // Equivalent to isConnected() but uses a single combined write/read of the
+  // VERSION register instead of an empty write followed by getVersion().
+  boolean probe(void);
+
+  // probeChannels() - Probe for a gauge on each of a list of I2C mux channels.
+  // Input: [channels] - The mux channel numbers to probe.
+  //        [numChannels] - The number of entries in [channels] and [results].
+  //        [selectChannel] - Called to select each channel on the mux before probing.
+  //        [results] - Filled with the presence and timing of each channel.
+  // Output: The number of channels on which a gauge was found.
+  uint8_t probeChannels(const uint8_t *channels, uint8_t numChannels, sfe_max1704x_select_channel_t selectChannel, sfe_max1704x_probe_result_t *results);
+
   // Debug
   void enableDebugging(Stream &debugPort = Serial); // enable debug messages
   void disableDebugging();                          // disable debug messages
@@ -140,6 +423,13 @@ public:
   // Output: floating point value between 0-5V in 1.25mV increments.
   float getVoltage();
 
+  // getFullScale([device]) - Return the VCELL full-scale voltage of [device].
+  // 5.12V for the MAX17043/48, 10.24V for the two-cell MAX17044/49.
+  static float getFullScale(sfe_max1704x_devices_e device);
+
+  // convertVoltage([vCell], [device]) - Convert a raw VCELL word into Volts.
+  static float convertVoltage(uint16_t vCell, sfe_max1704x_devices_e device);
+
   // getSOC() - Get the MAX17043's state-of-charge (SOC) reading, as calculated
   // by the IC's "ModelGauge" algorithm.
   // The first update is available approximately 1s after POR of the IC.
@@ -147,6 +437,25 @@ public:
   // full charge.
   float getSOC();
 
+  // convertSOC([soc]) - Convert a raw SOC word into percent.
+  static float convertSOC(uint16_t soc);
+
+  // getSnapshot([snapshot]) - Read VCELL, SOC, MODE, CONFIG and (MAX17048/49)
+  // CRATE and STATUS in a single burst read. This also refreshes the
+  // measurement cache (see enableCache).
+  // Output: 0 on success, positive integer on fail.
+  uint8_t getSnapshot(sfe_max1704x_snapshot_t &snapshot);
+
+  // serializeSnapshot([snapshot], [frame], [frameSize]) - Encode [snapshot]
+  // into [frame] using the fixed layout described at MAX1704X_FRAME_VERSION.
+  // Output: the number of bytes written (MAX1704X_FRAME_LENGTH). 0 if [frameSize] is too small.
+  static uint8_t serializeSnapshot(const sfe_max1704x_snapshot_t &snapshot, uint8_t *frame, uint8_t frameSize);
+
+  // deserializeSnapshot([frame], [frameLength], [snapshot]) - Decode a frame
+  // written by serializeSnapshot. Uses no Arduino or bus functions.
+  // Output: 0 on success, positive integer if the frame is short or not recognised.
+  static uint8_t deserializeSnapshot(const uint8_t *frame, uint8_t frameLength, sfe_max1704x_snapshot_t &snapshot);
+
   // getVersion() - Get the MAX17043's production version number.
   // Output: 3 on success
   uint16_t getVersion();
@@ -178,11 +487,65 @@ public:
   // Output: 0 on success, positive integer on fail.
   uint8_t wake();
 
+  // setPowerState([state]) - Move the IC to [state], issuing only the writes
+  // the transition needs. The state is tracked by the library, so setting the
+  // current state again does not access the bus.
+  // SLEEP: sets MODE.EnSleep (MAX17048/49, only if not already set) then CONFIG.SLEEP
+  // ACTIVE / HIBERNATE / AUTO_HIBERNATE: clears CONFIG.SLEEP if sleeping, then
+  // writes HIBRT (MAX17048/49, only if it changes). AUTO_HIBERNATE restores the
+  // most recent thresholds written with setHIBRTActThr / setHIBRTHibThr /
+  // applyProfile (the POR value 0x8030 by default).
+  // Unlike wake(), MODE.EnSleep is left set on waking. Note: while EnSleep is set
+  // the IC will also sleep if SDA and SCL are both held low for more than 2.5s.
+  // HIBERNATE and AUTO_HIBERNATE are not supported on the MAX17043/44.
+  // Output: 0 on success, positive integer on fail.
+  uint8_t setPowerState(sfe_max1704x_power_state_e state);
+
+  // getPowerState() - Return the tracked power state. Does not access the bus.
+  sfe_max1704x_power_state_e getPowerState();
+
+  // getPowerTransitionMicros() - Return how long the most recent call to
+  // setPowerState took, in microseconds.
+  unsigned long getPowerTransitionMicros();
+
+  // getICCurrent([device], [state]) - The typical supply current of [device]
+  // in power [state], in uA. UNKNOWN and AUTO_HIBERNATE are treated as ACTIVE.
+  static float getICCurrent(sfe_max1704x_devices_e device, sfe_max1704x_power_state_e state);
+
+  // Bus activity since resetBusCounters(). Each write16, read16 and
+  // readRegisters is one transaction. Bytes include the address bytes.
+  uint32_t getBusTransactions();
+  uint32_t getBusBytes();
+  void resetBusCounters();
+
+  // estimateAverageCurrent([elapsedMillis], [busClock], [mcuActiveCurrent]) -
+  // Estimate the average current (uA) drawn for the gauge over the last
+  // [elapsedMillis]: the IC's supply current in each tracked power state,
+  // weighted by the time spent in it (using MODE.HIBSTAT, when it is read,
+  // while automatic hibernate is in use), plus the MCU's [mcuActiveCurrent]
+  // (uA) for the time the bus counters say it spent on I2C at [busClock] Hz.
+  // Call resetBusCounters() at the start of the period: it also restarts the
+  // time spent in each state.
+  // Comparing the estimate for different polling strategies over the same
+  // period shows which is cheapest.
+  float estimateAverageCurrent(unsigned long elapsedMillis, uint32_t busClock = 100000, float mcuActiveCurrent = 5000.0);
+
   // reset() - Issue a Power-on-reset command to the MAX17043. This function
   // will reset every register in the MAX17043 to its default value.
   // Output: Positive integer on success, 0 on fail.
+  // See resetAndWait() for a reset which waits for the IC to be ready again.
   uint8_t reset();
 
+  // resetAndWait([timing], [timeoutMillis], [pollMillis]) - Issue a
+  // Power-on-reset (ignoring the missing ACK), then poll every [pollMillis]
+  // until the IC answers again and VCELL and SOC hold their first conversion.
+  // (If VCELL is valid but SOC is still zero at the timeout, the battery is
+  // taken to be empty.) The RI flag is left set (see isReset).
+  // Input: [timing] - If not NULL, filled with the time taken by each phase.
+  //        [timeoutMillis] - The maximum time to wait.
+  // Output: 0 on success, positive integer on fail or timeout.
+  uint8_t resetAndWait(sfe_max1704x_reset_timing_t *timing = NULL, unsigned long timeoutMillis = 1500, unsigned long pollMillis = 2);
+
   // getConfigRegister() - Read the 16-bit value of the CONFIG Register.
   // Output: 16-bit integer value representing the msb and lsb bytes of the
   // CONFIG register.
@@ -215,6 +578,17 @@ public:
   // Output: 0 on success, positive integer on fail.
   uint8_t setCompensation(uint8_t newCompensation = 0x97);
 
+  // calculateCompensation([temperature], [rcomp0], [tempCoUp], [tempCoDown]) -
+  // Calculate RCOMP for the battery [temperature] (degrees Celsius) using the
+  // formula above. The defaults are those of the default model.
+  // Output: RCOMP, rounded and limited to 0-255.
+  static uint8_t calculateCompensation(float temperature, uint8_t rcomp0 = 0x97, float tempCoUp = -0.5, float tempCoDown = -5.0);
+
+  // compensateTemperature([temperature], [rcomp0], [tempCoUp], [tempCoDown]) -
+  // Set RCOMP for the battery [temperature]. Call at least once per minute.
+  // Output: 0 on success, positive integer on fail.
+  uint8_t compensateTemperature(float temperature, uint8_t rcomp0 = 0x97, float tempCoUp = -0.5, float tempCoDown = -5.0);
+
   // getID() - (MAX17048/49) Returns 8-bit OTP bits set at factory. Can be used to
   // 'to distinguish multiple cell types in production'.
   // Writes to these bits are ignored.
@@ -252,6 +626,9 @@ public:
   // A positive rate is charging, negative is discharge.
   float getChangeRate();
 
+  // convertChangeRate([changeRate]) - Convert a raw CRATE word into %/hr.
+  static float convertChangeRate(int16_t changeRate);
+
   // getStatus() - (MAX17048/49) Get the 7 bits of status register
   // Output: 7-bits indicating various alerts
   uint8_t getStatus();
@@ -347,6 +724,168 @@ public:
   // Output: 0 on success, positive integer on fail.
   uint8_t disableHibernate();
 
+  // enableCache() - Cache the VCELL, SOC and CRATE registers.
+  // When enabled, getVoltage(), getSOC() and getChangeRate() only read the
+  // register again once the IC could have completed a new conversion:
+  // every 500ms on the MAX17043/44; every 250ms on the MAX17048/49, or every
+  // 45s while MODE.HIBSTAT shows the IC is hibernating.
+  // On the MAX17048/49 HIBSTAT is re-read at most once per 45s (or whenever
+  // isHibernating() is called).
+  // The cache is disabled by default.
+  void enableCache();
+  void disableCache();
+
+  // invalidateCache() - Discard all cached register values, forcing the next
+  // call to read the IC. quickStart(), reset(), sleep(), wake() and any
+  // write which changes HIBRT do this automatically.
+  void invalidateCache();
+
+  // getDefaultProfile([profile]) - Fill [profile] with the power-on-reset
+  // configuration of the IC.
+  static void getDefaultProfile(sfe_max1704x_profile_t &profile);
+
+  // getProfile([profile]) - Read the current configuration into [profile].
+  // Uses a single burst read.
+  // Output: 0 on success, positive integer on fail.
+  uint8_t getProfile(sfe_max1704x_profile_t &profile);
+
+  // applyProfile([profile]) - Apply a complete configuration.
+  // The configuration registers are burst-read once, each register whose
+  // contents need to change is written exactly once, and the result is verified
+  // with a single burst read. Registers which already hold the requested
+  // values are not written (and nothing is verified if nothing was written).
+  // Output: 0 on success, positive integer on fail.
+  // MAX17043_GENERIC_ERROR is returned if the verification fails.
+  uint8_t applyProfile(const sfe_max1704x_profile_t &profile);
+
+  // enableAlertTracking([window], [emptyThreshold]) - (MAX17048/49) "Zero-poll" mode.
+  // Programs the empty threshold (see setThreshold), enables the 1% SOC change
+  // alert and sets the VALRT window to VCELL +/- [window] so that ALRT only
+  // asserts when something changes. Call serviceAlertTracking() each time ALRT
+  // asserts. Uses one burst read and at most three writes.
+  // Input: [window] - Half-width of the voltage window, per cell. LSb = 20mV.
+  //        [emptyThreshold] - 1-32%.
+  // Output: 0 on success, positive integer on fail.
+  uint8_t enableAlertTracking(uint8_t window = 5, uint8_t emptyThreshold = 4);
+
+  // disableAlertTracking() - (MAX17048/49) Open the VALRT window fully and
+  // disable the SOC change alert. Writes CVALRT once and CONFIG (read-modify-write)
+  // only if the SOC change alert is enabled.
+  // Output: 0 on success, positive integer on fail.
+  uint8_t disableAlertTracking();
+
+  // serviceAlertTracking([status]) - (MAX17048/49) Call when ALRT asserts.
+  // Reads everything in one burst, re-centers the VALRT window on the present
+  // VCELL, and clears the STATUS flags and CONFIG.ALRT, using at most three writes.
+  // Input: [status] - Set to the 7 STATUS bits (see getStatus) that caused the
+  // alert. 0 if none were set, or if the read failed.
+  // Output: 0 on success, positive integer if a read or write failed.
+  uint8_t serviceAlertTracking(uint8_t &status);
+
+  // serviceAlerts([queue], [event]) - Drain all the ALRT edges captured in
+  // [queue] and service them with a single read: one burst on the MAX17048/49
+  // (see serviceAlertTracking, which also re-centers the VALRT window if alert
+  // tracking is enabled), or CONFIG on the MAX17043/44. The alert is cleared.
+  // Input: [event] - Optional. Filled with the burst details, timing and result.
+  // Output: The alert status (see sfe_max1704x_alert_event_t). 0 if no edges were queued.
+  template <uint8_t N>
+  uint8_t serviceAlerts(SFE_MAX1704X_AlertQueue<N> &queue, sfe_max1704x_alert_event_t *event = NULL)
+  {
+    unsigned long timestamp;
+    if (queue.pop(timestamp) == false)
+      return (0); // Nothing to do
+
+    uint8_t edges = 1;
+    unsigned long first = timestamp;
+    while (queue.pop(timestamp))
+    {
+      if (edges < 255)
+        edges++;
+    }
+
+    uint8_t status = 0;
+    uint8_t result = 0;
+    if (_device > MAX1704X_MAX17044)
+      result = serviceAlertTracking(status);
+    else
+    {
+      uint16_t configReg;
+      result = readRegisters(MAX17043_CONFIG, &configReg, 1); // Unlike getAlert, reports a failed read
+      if ((result == 0) && (configReg & MAX17043_CONFIG_ALERT))
+      {
+        status = 1;
+        result = write16(configReg & ~MAX17043_CONFIG_ALERT, MAX17043_CONFIG); // Clear ALRT
+      }
+    }
+
+    if (event != NULL)
+    {
+      event->edges = edges;
+      event->firstMicros = first;
+      event->lastMicros = timestamp;
+      event->latencyMicros = micros() - first;
+      event->status = status;
+      event->result = result;
+    }
+    return (status);
+  }
+
+  // getConfigFingerprint([fingerprint]) - Compute a 32-bit fingerprint of the
+  // configuration held by the IC: the CONFIG LSB (excluding SLEEP and ALRT)
+  // and, on the MAX17048/49, CVALRT, HIBRT, VRESET/ID and STATUS.EnVR.
+  // RCOMP is excluded as it is expected to change with temperature.
+  // Store the fingerprint (e.g. in RTC memory) after configuring the gauge.
+  // Uses a single burst read.
+  // Output: 0 on success, positive integer on fail.
+  uint8_t getConfigFingerprint(uint32_t &fingerprint);
+
+  // resumeIfConfigured([fingerprint]) - Check if the IC still holds the
+  // configuration described by [fingerprint], e.g. after a host-only reset.
+  // Uses a single burst read.
+  // Output: true if the fingerprint matches (and, on the MAX17048/49, the RI
+  // flag is clear) so configuration can be skipped. false if the gauge needs
+  // to be (re)configured. On a match the power state and the HIBRT thresholds
+  // are taken from the IC, so setPowerState() keeps them.
+  boolean resumeIfConfigured(uint32_t fingerprint);
+
+  // getField<[field]>() - Read a single register field, right-aligned.
+  // See sfe_max1704x_field_e.
+  // Output: the field value. 0 if the field is not supported on this device.
+  template <sfe_max1704x_field_e F>
+  uint16_t getField()
+  {
+    if (!fieldSupported(MAX1704X_FIELDS[F].max17048Only))
+      return (0);
+    return ((read16(MAX1704X_FIELDS[F].address) & MAX1704X_FIELDS[F].mask) >> MAX1704X_FIELDS[F].shift);
+  }
+
+  // setField<[field]>([value]) - Write a single register field. Other fields in
+  // the register are preserved with a read-modify-write.
+  // Output: 0 on success, positive integer on fail.
+  template <sfe_max1704x_field_e F>
+  uint8_t setField(uint16_t value)
+  {
+    if (!fieldSupported(MAX1704X_FIELDS[F].max17048Only))
+      return (MAX17043_GENERIC_ERROR);
+    return writeField(MAX1704X_FIELDS[F].address, MAX1704X_FIELDS[F].mask, MAX1704X_FIELDS[F].shift, value);
+  }
+
+  // decodeField<[field]>([block], [startAddress]) - Extract a field from a
+  // burst read, e.g. from readRegisters. No bus access.
+  // Input: [block] - The registers, as read by readRegisters.
+  //        [startAddress] - The address of block[0].
+  // Output: the field value, right-aligned.
+  template <sfe_max1704x_field_e F>
+  static uint16_t decodeField(const uint16_t *block, uint8_t startAddress = MAX1704X_REGISTER_BLOCK_START)
+  {
+    return ((block[(MAX1704X_FIELDS[F].address - startAddress) >> 1] & MAX1704X_FIELDS[F].mask) >> MAX1704X_FIELDS[F].shift);
+  }
+
+  // getFieldLSB<[field]>() - The real-world value of one LSb of [field]
+  // (e.g. 0.02V for VALRT.MAX). 0 if not applicable.
+  template <sfe_max1704x_field_e F>
+  static float getFieldLSB() { return (MAX1704X_FIELDS[F].lsb); }
+
   //Lower level functions but exposed incase user wants them
 
   // write16([data], [address]) - Write 16 bits to the requested address. After
@@ -362,6 +901,16 @@ public:
   // Output: A 16-bit value read from the device's address will be returned.
   uint16_t read16(uint8_t address);
 
+  // readRegisters([address], [data], [numRegisters]) - Burst read
+  // [numRegisters] sequential 16-bit registers starting at [address] in a
+  // single I2C transaction. The IC auto-increments the register address.
+  // Input: [address] - The address of the first register.
+  //        [data] - Storage for [numRegisters] 16-bit values.
+  //        [numRegisters] - The number of registers to read. The Wire buffer
+  //        limits this to 16 on most platforms.
+  // Output: 0 on success, positive integer on fail.
+  uint8_t readRegisters(uint8_t address, uint16_t *data, uint8_t numRegisters);
+
 private:
   //Variables
   TwoWire *_i2cPort; //The generic connection to user's chosen I2C hardware
@@ -375,8 +924,977 @@ private:
   // Output: 0 on success, positive integer on fail.
   uint8_t clearStatusRegBits(uint16_t mask);
 
+  // Field access (see getField / setField)
+  boolean fieldSupported(boolean max17048Only);
+  uint8_t writeField(uint8_t address, uint16_t mask, uint8_t shift, uint16_t value);
+
+  // Burst read the configuration block (MAX17048/49), or just CONFIG (MAX17043/44).
+  // block must have room for MAX1704X_CONFIG_BLOCK_LENGTH registers.
+  // Output: 0 on success, positive integer on fail.
+  uint8_t readConfigBlock(uint16_t *block);
+
+  // Alert tracking (see enableAlertTracking)
+  // Write the VALRT window centered on [vcell], if it differs from [cvalrt]
+  uint8_t centerAlertWindow(uint16_t vcell, uint16_t cvalrt);
+  boolean _alertTracking = false;
+  uint8_t _alertWindow = 5;
+
+  // Compute the configuration fingerprint from a block read by readConfigBlock
+  uint32_t computeFingerprint(const uint16_t *block);
+
+  boolean _deviceDetected = false; // Has detectDevice been called successfully?
+
+  // Power state tracking (see setPowerState)
+  // Record that HIBRT has been written with [hibrt] and update the power state
+  void hibrtWritten(uint16_t hibrt);
+  // Record that CONFIG.SLEEP has been cleared: the state follows from HIBRT, if known
+  void sleepCleared();
+  // Change _powerState, charging the time spent in the old state (see estimateAverageCurrent)
+  void setTrackedPowerState(sfe_max1704x_power_state_e state);
+  sfe_max1704x_power_state_e _powerState = MAX1704X_POWER_UNKNOWN;
+  boolean _hibrtKnown = false;   // Is _hibrt the current contents of HIBRT?
+  uint16_t _hibrt = 0x8030;      // Last value written to HIBRT
+  uint16_t _autoHibrt = 0x8030;  // The thresholds to use for auto-hibernate. POR default
+  boolean _enSleepSet = false;   // Is MODE.EnSleep known to be set?
+  unsigned long _powerTransitionMicros = 0;
+
+  // Read a register through the measurement cache (see enableCache)
+  // Registers which are not cached are read directly with read16.
+  uint16_t readCached(uint8_t address);
+
+  // Measurement cache
+  boolean _cacheEnabled = false;
+  uint8_t _cacheValid = 0; // One bit per cached register: VCELL, SOC, CRATE
+  uint16_t _cacheValue[3];
+  unsigned long _cacheTime[3];
+  boolean _hibstatValid = false; // Is _hibstat valid?
+  boolean _hibstat = false; // Last value read from MODE.HIBSTAT
+  unsigned long _hibstatTime; // millis() when _hibstat was read
+
+  // Bus activity counters
+  uint32_t _busTransactions = 0;
+  uint32_t _busBytes = 0;
+
+  // Time spent in each power state since resetBusCounters (see estimateAverageCurrent)
+  // The state the IC is in: HIBERNATE while auto-hibernate is hibernating
+  sfe_max1704x_power_state_e getICPowerState();
+  // Add the time since the last change to the state the IC is in
+  void accountPowerState();
+  // Record MODE.HIBSTAT, charging the time spent before it changed
+  void hibstatRead(boolean hibstat);
+  uint32_t _stateMillis[MAX1704X_POWER_SLEEP + 1] = {0};
+  unsigned long _stateSince = 0;  // millis() of the last accountPowerState
+  boolean _hibernating = false;   // Last HIBSTAT seen in the current power state
+
   int _device = MAX1704X_MAX17043; // Default to MAX17043
-  float _full_scale = 5.12; // Default: full-scale for the MAX17043
+};
+
+////////////////////////////
+// MAX1704x Staged Writes //
+////////////////////////////
+// Accumulates field changes across several registers and commits each touched
+// register exactly once, e.g.:
+//   SFE_MAX1704X_StagedWrite changes(lipo);
+//   changes.stage<MAX1704X_FIELD_VALRT_MAX>(205);
+//   changes.stage<MAX1704X_FIELD_VALRT_MIN>(175); // Same register: no extra traffic
+//   changes.stage<MAX1704X_FIELD_RCOMP>(0x97);
+//   changes.commit(); // One read-modify-write of CVALRT, one of CONFIG
+// If every bit of a register is staged (e.g. both VALRT fields), the read is
+// skipped and the register is simply written.
+#define MAX1704X_STAGED_REGISTERS 6 // Maximum number of registers per commit
+
+class SFE_MAX1704X_StagedWrite
+{
+public:
+  SFE_MAX1704X_StagedWrite(SFE_MAX1704X &gauge);
+
+  // Stage a new [value] for field F. Staging the same field twice keeps the last value.
+  // Output: true on success. false if the field is not supported on this device,
+  // or too many registers have been staged.
+  template <sfe_max1704x_field_e F>
+  boolean stage(uint16_t value)
+  {
+    if (!_gauge->fieldSupported(MAX1704X_FIELDS[F].max17048Only))
+      return (false);
+    return stageBits(MAX1704X_FIELDS[F].address, MAX1704X_FIELDS[F].mask, (value << MAX1704X_FIELDS[F].shift) & MAX1704X_FIELDS[F].mask);
+  }
+
+  // Write all staged changes, one write (and at most one read) per register,
+  // then clear the staged changes.
+  // Output: 0 on success, positive integer on fail.
+  uint8_t commit();
+
+  // Discard all staged changes
+  void clear();
+
+  uint8_t getNumRegisters() { return (_numRegisters); } // Registers staged
+
+private:
+  boolean stageBits(uint8_t address, uint16_t mask, uint16_t bits);
+
+  SFE_MAX1704X *_gauge;
+  uint8_t _numRegisters;
+  uint8_t _address[MAX1704X_STAGED_REGISTERS];
+  uint16_t _mask[MAX1704X_STAGED_REGISTERS]; // Staged bits
+  uint16_t _bits[MAX1704X_STAGED_REGISTERS]; // Staged values, aligned
+};
+
+////////////////////////////
+// MAX1704x Register View //
+////////////////////////////
+// Decodes registers which have already been read by something else, e.g. a
+// DMA-driven I2C transfer. The view points at the caller's buffer: the bytes
+// are not copied and there is no bus access. The buffer holds big-endian
+// register words (exactly as they come off the bus) starting at any register
+// address, e.g.:
+//   uint8_t rx[2 * MAX1704X_REGISTER_BLOCK_LENGTH]; // Filled by the DMA driver
+//   SFE_MAX1704X_RegisterView view(rx, sizeof(rx), MAX17043_VCELL, MAX1704X_MAX17048);
+//   float soc = view.getSOC();
+// The buffer must stay valid for as long as the view is used.
+// Registers which are not in the buffer read as zero.
+class SFE_MAX1704X_RegisterView
+{
+public:
+  SFE_MAX1704X_RegisterView(const uint8_t *bytes, uint8_t numBytes,
+                            uint8_t startAddress = MAX1704X_REGISTER_BLOCK_START,
+                            sfe_max1704x_devices_e device = MAX1704X_MAX17043);
+
+  // Does the buffer contain the register at [address]?
+  boolean contains(uint8_t address);
+
+  // getRegister([address]) - The raw register word at [address]. Zero if not in the buffer.
+  uint16_t getRegister(uint8_t address);
+
+  // Same results as the SFE_MAX1704X methods with the same names
+  float getVoltage();
+  float getSOC();
+  float getChangeRate(); // (MAX17048/49) 0.0 on the MAX17043/44
+  uint8_t getStatus();   // (MAX17048/49) 0 on the MAX17043/44
+
+  // getField<[field]>() - Extract a field. Zero if its register is not in the buffer.
+  template <sfe_max1704x_field_e F>
+  uint16_t getField()
+  {
+    return ((getRegister(MAX1704X_FIELDS[F].address) & MAX1704X_FIELDS[F].mask) >> MAX1704X_FIELDS[F].shift);
+  }
+
+private:
+  const uint8_t *_bytes;
+  uint8_t _numBytes;
+  uint8_t _startAddress;
+  sfe_max1704x_devices_e _device;
+};
+
+////////////////////////////////
+// MAX1704x Window Statistics //
+////////////////////////////////
+// Statistics of one raw register value (e.g. VCELL) over a sliding window of
+// the last N samples (N <= 128), plus Welford mean and variance over all
+// samples since reset(). add() is O(1) (amortized) and uses no dynamic memory.
+// The minimum and maximum are tracked with monotonic deques. The window mean
+// and variance are computed from exact integer sums, offset by the first sample;
+// the variance numerator (count x sum of squares - sum^2) is evaluated exactly
+// in 64 bits, so only the final division is done in float.
+// T is the raw register type: uint16_t for VCELL and SOC, int16_t for CRATE.
+template <typename T, uint8_t N>
+class SFE_MAX1704X_WindowStats
+{
+public:
+  SFE_MAX1704X_WindowStats() { reset(); }
+
+  void reset()
+  {
+    _head = 0;
+    _count = 0;
+    _minFront = _minLen = 0;
+    _maxFront = _maxLen = 0;
+    _sum = 0;
+    _sumSq = 0;
+    _total = 0;
+    _mean = 0.0;
+    _m2 = 0.0;
+  }
+
+  void add(T sample)
+  {
+    if (_total == 0)
+      _offset = sample;
+
+    if (_count == N)
+    {
+      // The window is full: the sample in _head drops out
+      int32_t old = (int32_t)_ring[_head] - _offset;
+      _sum -= old;
+      _sumSq -= (int64_t)old * old;
+      if (_minLen && (_minQ[_minFront] == _head))
+        popFront(_minFront, _minLen);
+      if (_maxLen && (_maxQ[_maxFront] == _head))
+        popFront(_maxFront, _maxLen);
+    }
+    else
+      _count++;
+
+    _ring[_head] = sample;
+    int32_t d = (int32_t)sample - _offset;
+    _sum += d;
+    _sumSq += (int64_t)d * d;
+
+    // Keep the deques monotonic: drop everything the new sample makes redundant
+    while (_minLen && (_ring[_minQ[(_minFront + _minLen - 1) % N]] >= sample))
+      _minLen--;
+    _minQ[(_minFront + _minLen++) % N] = _head;
+    while (_maxLen && (_ring[_maxQ[(_maxFront + _maxLen - 1) % N]] <= sample))
+      _maxLen--;
+    _maxQ[(_maxFront + _maxLen++) % N] = _head;
+
+    _head = (_head + 1) % N;
+
+    // Welford
+    _total++;
+    float delta = (float)sample - _mean;
+    _mean += delta / _total;
+    _m2 += delta * ((float)sample - _mean);
+  }
+
+  uint8_t count() { return (_count); } // Samples in the window
+  T minimum() { return (_minLen ? _ring[_minQ[_minFront]] : 0); }
+  T maximum() { return (_maxLen ? _ring[_maxQ[_maxFront]] : 0); }
+  float mean() { return (_count ? _offset + ((float)_sum / _count) : 0.0); }
+  float variance() // Population variance over the window
+  {
+    if (_count == 0)
+      return (0.0);
+    // (count * sumSq - sum^2) / count^2, with the numerator computed exactly.
+    // It can not be negative, and it does not suffer from cancellation when
+    // the window has drifted far from _offset
+    int64_t numerator = ((int64_t)_count * _sumSq) - ((int64_t)_sum * _sum);
+    return ((float)numerator / ((float)_count * (float)_count));
+  }
+
+  uint32_t totalCount() { return (_total); } // Samples since reset
+  float totalMean() { return (_mean); }
+  float totalVariance() { return (_total > 1 ? _m2 / (_total - 1) : 0.0); } // Sample variance since reset
+
+private:
+  static void popFront(uint8_t &front, uint8_t &len)
+  {
+    front = (front + 1) % N;
+    len--;
+  }
+
+  T _ring[N];
+  uint8_t _head;  // Where the next sample goes
+  uint8_t _count; // Samples in the window
+  uint8_t _minQ[N]; // Ring indices of increasing values
+  uint8_t _minFront, _minLen;
+  uint8_t _maxQ[N]; // Ring indices of decreasing values
+  uint8_t _maxFront, _maxLen;
+  T _offset;      // The first sample
+  int32_t _sum;   // Sum of (sample - _offset) over the window
+  int64_t _sumSq; // Sum of (sample - _offset)^2 over the window
+  uint32_t _total;
+  float _mean;
+  float _m2;
+};
+
+// Window statistics of VCELL, SOC and CRATE, fed from getSnapshot()
+template <uint8_t N>
+class SFE_MAX1704X_SnapshotStats
+{
+public:
+  void reset()
+  {
+    vcell.reset();
+    soc.reset();
+    crate.reset();
+  }
+
+  void add(const sfe_max1704x_snapshot_t &snapshot)
+  {
+    vcell.add(snapshot.vcell);
+    soc.add(snapshot.soc);
+    if (snapshot.device > MAX1704X_MAX17044)
+      crate.add(snapshot.crate);
+  }
+
+  SFE_MAX1704X_WindowStats<uint16_t, N> vcell;
+  SFE_MAX1704X_WindowStats<uint16_t, N> soc;
+  SFE_MAX1704X_WindowStats<int16_t, N> crate; // MAX17048/49 only
+};
+
+///////////////////////////////
+// MAX1704x Change Reporting //
+///////////////////////////////
+// Decides which snapshots are worth sending, e.g. over a radio link. A snapshot
+// is reported when VCELL, SOC or CRATE has moved by more than its deadband
+// (in raw LSbs) since the last reported snapshot, when STATUS or CONFIG.ALRT
+// has changed, or when nothing has been reported for maxSilenceMillis:
+//   SFE_MAX1704X_ReportFilter filter;
+//   if ((lipo.getSnapshot(snapshot) == 0) && filter.check(snapshot))
+//     send(snapshot);
+// The default deadbands are 10mV per cell, 1% and 1.04%/hr.
+class SFE_MAX1704X_ReportFilter
+{
+public:
+  SFE_MAX1704X_ReportFilter(uint16_t vcellDeadband = 128, uint16_t socDeadband = 256,
+                            uint16_t crateDeadband = 5, unsigned long maxSilenceMillis = 60000);
+
+  // Deadbands in raw LSbs: VCELL 78.125uV per cell, SOC 1/256%, CRATE 0.208%/hr.
+  // A deadband of 0 reports every change.
+  void setDeadbands(uint16_t vcellDeadband, uint16_t socDeadband, uint16_t crateDeadband);
+
+  // Report at least this often, even if nothing has changed. 0 disables the limit.
+  void setMaxSilence(unsigned long maxSilenceMillis);
+
+  // check([snapshot]) - Should [snapshot] be reported? If so, it becomes the
+  // reference for later checks. The first snapshot is always reported.
+  boolean check(const sfe_max1704x_snapshot_t &snapshot);
+
+  // Forget the reference snapshot, so the next check reports. The counters are kept.
+  void reset();
+
+  uint32_t getReported() { return (_reported); }     // Snapshots reported
+  uint32_t getSuppressed() { return (_suppressed); } // Snapshots suppressed
+  void resetCounters();
+
+private:
+  uint16_t _vcellDeadband;
+  uint16_t _socDeadband;
+  uint16_t _crateDeadband;
+  unsigned long _maxSilenceMillis;
+  boolean _haveReference;
+  sfe_max1704x_snapshot_t _reference; // The last reported snapshot
+  uint32_t _reported;
+  uint32_t _suppressed;
+};
+
+////////////////////////////////
+// MAX1704x Hibernate Advisor //
+////////////////////////////////
+// Recommends MAX17048/49 HIBRT thresholds from observed snapshots.
+// The IC enters hibernate when |CRATE| stays below HibThr for 6 minutes, and
+// leaves it when |OCV - VCELL| exceeds ActThr. In hibernate it only converts
+// every 45s, so SOC can lag by up to |CRATE| x 45s. The advisor recommends:
+//   HibThr: the fastest |CRATE| which keeps the lag within maxLag (% SOC).
+//           This maximizes the time in hibernate within the accuracy bound
+//   ActThr: the 99th percentile of |delta VCELL| between snapshots slower than
+//           HibThr, kept in a histogram, so noise does not wake the IC,
+//           limited to maxActThr
+// It also reports the fraction of snapshots taken with MODE.HIBSTAT set, e.g.:
+//   SFE_MAX1704X_HibernateAdvisor advisor;
+//   if (lipo.getSnapshot(snapshot) == 0)
+//     advisor.add(snapshot); // Ideally at a regular interval
+//   ...
+//   advisor.apply(lipo); // One write of HIBRT
+#define MAX1704X_ADVISOR_BINS 32         // Histogram bins (plus one overflow bin)
+#define MAX1704X_ADVISOR_DVCELL_BIN 32   // VCELL LSbs (78.125uV) per bin: 2.5mV
+#define MAX1704X_ADVISOR_CONVERSION_SECONDS 45.0 // Conversion period in hibernate
+
+class SFE_MAX1704X_HibernateAdvisor
+{
+public:
+  // [maxLag] - The most the SOC may lag (%) due to the slower hibernate conversions
+  // [maxActThr] - Upper limit for the recommended ActThr (LSb = 1.25mV)
+  SFE_MAX1704X_HibernateAdvisor(float maxLag = 0.1, uint8_t maxActThr = 0x30);
+
+  // add([snapshot]) - Add a MAX17048/49 snapshot. MAX17043/44 snapshots are ignored.
+  void add(const sfe_max1704x_snapshot_t &snapshot);
+
+  // Clear the histogram and the hibernate counters
+  void reset();
+
+  uint32_t getNumSamples() { return (_samples); }
+
+  // The fraction (0-1) of snapshots taken while the IC was hibernating
+  float getHibernateFraction();
+
+  // The recommended thresholds. HibThr depends only on maxLag. Until quiet
+  // samples have been added, ActThr is the POR default (0x30), limited to maxActThr.
+  uint8_t getRecommendedHibThr() { return (_hibThr); } // LSb = 0.208%/hr
+  uint8_t getRecommendedActThr(); // LSb = 1.25mV
+
+  // apply([gauge]) - Write both recommended thresholds to [gauge] in a single write.
+  // Output: 0 on success, positive integer on fail (including no samples yet).
+  uint8_t apply(SFE_MAX1704X &gauge);
+
+private:
+  // The upper edge of the 99th percentile bin of [histogram], counting only
+  // the first [numBins] bins
+  static uint16_t percentile99(const uint16_t *histogram, uint8_t numBins);
+  static void addToHistogram(uint16_t *histogram, uint8_t bin);
+
+  uint8_t _hibThr; // The lag bound, in CRATE LSbs
+  uint8_t _maxActThr;
+  uint16_t _dVcellHistogram[MAX1704X_ADVISOR_BINS + 1]; // Only samples within the lag bound
+  boolean _havePrevious;
+  uint16_t _previousVcell;
+  uint32_t _samples;
+  uint32_t _hibernating;
+};
+
+//////////////////////////////
+// MAX1704x Frozen Watchdog //
+//////////////////////////////
+// Detects a gauge whose measurements have frozen (e.g. after a brownout) from
+// the snapshots the sketch already takes, so detection adds no bus traffic.
+// The gauge is considered frozen when VCELL and SOC have not changed by a
+// single LSb for windowMillis even though there was activity: |CRATE| at or
+// above activityThreshold, or externalActivity reported by the caller (e.g.
+// from a current sensor; the MAX17043/44 have no CRATE). Recovery escalates,
+// one step each time the gauge is still frozen after another window:
+//   1. quickStart()
+//   2. reset(). At the next check the POR is verified with the RI flag
+//      (MAX17048/49) and the stored profile (if any) is re-applied
+//   3. Nothing more can be done: MAX1704X_WATCHDOG_FAILED
+// Any change of VCELL or SOC returns the watchdog to step 1.
+//   SFE_MAX1704X_FrozenWatchdog watchdog(lipo, &profile);
+//   if (lipo.getSnapshot(snapshot) == 0)
+//     watchdog.check(snapshot);
+
+typedef enum {
+  MAX1704X_WATCHDOG_NONE = 0,        // Not frozen (or not frozen for long enough)
+  MAX1704X_WATCHDOG_QUICK_START,     // Frozen: quickStart() was issued
+  MAX1704X_WATCHDOG_RESET,           // Still frozen: reset() was issued
+  MAX1704X_WATCHDOG_REAPPLY_PROFILE, // The POR was verified and the profile (if any) re-applied
+  MAX1704X_WATCHDOG_FAILED           // The POR could not be verified, the profile could not be applied, or still frozen
+} sfe_max1704x_watchdog_action_e;
+
+class SFE_MAX1704X_FrozenWatchdog
+{
+public:
+  // [profile] is re-applied after a reset. It must remain valid. NULL leaves the POR configuration.
+  SFE_MAX1704X_FrozenWatchdog(SFE_MAX1704X &gauge, const sfe_max1704x_profile_t *profile = NULL,
+                              unsigned long windowMillis = 600000, uint16_t activityThreshold = 5);
+
+  // check([snapshot], [externalActivity]) - Check the latest snapshot and take
+  // the next recovery step if the gauge is frozen.
+  // Output: the recovery step taken, if any.
+  sfe_max1704x_watchdog_action_e check(const sfe_max1704x_snapshot_t &snapshot, boolean externalActivity = false);
+
+  // Restart detection and recovery from scratch
+  void reset();
+
+  uint32_t getRecoveries() { return (_recoveries); } // Recovery steps taken
+
+private:
+  SFE_MAX1704X *_gauge;
+  const sfe_max1704x_profile_t *_profile;
+  unsigned long _windowMillis;
+  uint16_t _activityThreshold;
+  boolean _haveReference;
+  uint16_t _vcell;
+  uint16_t _soc;
+  unsigned long _lastChange; // millis of the snapshot which last changed (or the last recovery step)
+  boolean _activity;         // Activity seen since _lastChange
+  uint8_t _step;             // The next recovery step
+  uint32_t _recoveries;
+};
+
+///////////////////////////////
+// MAX1704x Pack Aggregation //
+///////////////////////////////
+// Pack-level metrics for a pack with one gauge per module (N modules, N <= 255).
+// Feed each module's snapshot into update(). Metrics are maintained
+// incrementally: sums are adjusted in O(1) and the min/max are only rescanned
+// when the module which held them moves away from the extreme.
+// Cell voltages are raw VCELL units _per cell_: 78.125uV per LSb on every
+// device (the MAX17043/44 VCELL is 12 bits of 1.25mV per cell, left-aligned).
+// The number of cells in each module comes from SFE_MAX1704X::getFullScale.
+template <uint8_t N>
+class SFE_MAX1704X_Pack
+{
+public:
+  SFE_MAX1704X_Pack() { reset(); }
+
+  void reset()
+  {
+    for (uint8_t i = 0; i < N; i++)
+    {
+      _valid[i] = false;
+      _soc[i] = 0;
+      _cellVoltage[i] = 0;
+      _cells[i] = 1;
+    }
+    _numValid = 0;
+    _socSum = 0;
+    _packVoltageSum = 0;
+    _minSOCModule = _minCellModule = _maxCellModule = 0;
+  }
+
+  // Update [module] (0 to N-1) from its snapshot
+  void update(uint8_t module, const sfe_max1704x_snapshot_t &snapshot)
+  {
+    if (module >= N)
+      return;
+
+    uint8_t cells = (SFE_MAX1704X::getFullScale(snapshot.device) > 5.12) ? 2 : 1;
+    uint16_t cellVoltage = snapshot.vcell;
+    if (snapshot.device <= MAX1704X_MAX17044)
+      cellVoltage &= 0xFFF0; // Bits 3-0 are not part of the 12-bit result
+
+    if (_valid[module])
+    {
+      _socSum -= _soc[module];
+      _packVoltageSum -= (uint32_t)_cellVoltage[module] * _cells[module];
+    }
+    else
+    {
+      _valid[module] = true;
+      _numValid++;
+    }
+
+    uint16_t oldSOC = _soc[module];
+    uint16_t oldCell = _cellVoltage[module];
+    _soc[module] = snapshot.soc;
+    _cellVoltage[module] = cellVoltage;
+    _cells[module] = cells;
+    _socSum += snapshot.soc;
+    _packVoltageSum += (uint32_t)cellVoltage * cells;
+
+    if (_numValid == 1)
+    {
+      _minSOCModule = _minCellModule = _maxCellModule = module;
+      return;
+    }
+
+    // Only rescan when the module holding an extreme has moved away from it
+    bool needRescan = false;
+
+    if (module == _minSOCModule)
+      needRescan |= (snapshot.soc > oldSOC);
+    else if (snapshot.soc < _soc[_minSOCModule])
+      _minSOCModule = module;
+
+    if (module == _minCellModule)
+      needRescan |= (cellVoltage > oldCell);
+    else if (cellVoltage < _cellVoltage[_minCellModule])
+      _minCellModule = module;
+
+    if (module == _maxCellModule)
+      needRescan |= (cellVoltage < oldCell);
+    else if (cellVoltage > _cellVoltage[_maxCellModule])
+      _maxCellModule = module;
+
+    if (needRescan)
+      rescan();
+  }
+
+  // Read a snapshot from [gauge] and update [module] with it
+  // Output: 0 on success, positive integer on fail.
+  uint8_t update(uint8_t module, SFE_MAX1704X &gauge)
+  {
+    sfe_max1704x_snapshot_t snapshot;
+    uint8_t result = gauge.getSnapshot(snapshot);
+    if (result == 0)
+      update(module, snapshot);
+    else
+      invalidate(module);
+    return (result);
+  }
+
+  // Remove [module] from the metrics, e.g. when its gauge stops answering,
+  // until it is updated again
+  void invalidate(uint8_t module)
+  {
+    if ((module >= N) || !_valid[module])
+      return;
+
+    _valid[module] = false;
+    _numValid--;
+    _socSum -= _soc[module];
+    _packVoltageSum -= (uint32_t)_cellVoltage[module] * _cells[module];
+
+    if ((module == _minSOCModule) || (module == _minCellModule) || (module == _maxCellModule))
+      rescan();
+  }
+
+  uint8_t getNumModules() { return (_numValid); } // Modules which have been updated
+
+  // Pack SOC in percent. For a series pack this is the weakest module
+  float getMinSOC() { return (_numValid ? SFE_MAX1704X::convertSOC(_soc[_minSOCModule]) : 0.0); }
+  // Mean module SOC in percent. For a parallel pack
+  float getMeanSOC() { return (_numValid ? (((float)_socSum) / _numValid) / 256.0 : 0.0); }
+  uint8_t getMinSOCModule() { return (_minSOCModule); }
+
+  // Weakest and strongest cell voltages, and the imbalance between them, in Volts
+  float getMinCellVoltage() { return (_numValid ? _cellVoltage[_minCellModule] * CELL_LSB : 0.0); }
+  float getMaxCellVoltage() { return (_numValid ? _cellVoltage[_maxCellModule] * CELL_LSB : 0.0); }
+  float getImbalance() { return (_numValid ? (_cellVoltage[_maxCellModule] - _cellVoltage[_minCellModule]) * CELL_LSB : 0.0); }
+  uint8_t getMinCellModule() { return (_minCellModule); }
+  uint8_t getMaxCellModule() { return (_maxCellModule); }
+
+  // Sum of all module voltages (i.e. the voltage of a series pack), in Volts
+  float getPackVoltage() { return (_packVoltageSum * CELL_LSB); }
+
+private:
+  static constexpr float CELL_LSB = 0.000078125; // 78.125uV per cell per LSb
+
+  void rescan()
+  {
+    bool first = true;
+    for (uint8_t i = 0; i < N; i++)
+    {
+      if (!_valid[i])
+        continue;
+      if (first)
+      {
+        _minSOCModule = _minCellModule = _maxCellModule = i;
+        first = false;
+        continue;
+      }
+      if (_soc[i] < _soc[_minSOCModule])
+        _minSOCModule = i;
+      if (_cellVoltage[i] < _cellVoltage[_minCellModule])
+        _minCellModule = i;
+      if (_cellVoltage[i] > _cellVoltage[_maxCellModule])
+        _maxCellModule = i;
+    }
+  }
+
+  bool _valid[N];
+  uint16_t _soc[N];
+  uint16_t _cellVoltage[N]; // Raw, per cell
+  uint8_t _cells[N];        // Cells per module
+  uint8_t _numValid;
+  uint32_t _socSum;
+  uint32_t _packVoltageSum; // Raw, per cell units
+  uint8_t _minSOCModule;
+  uint8_t _minCellModule;
+  uint8_t _maxCellModule;
+};
+
+////////////////////////////
+// MAX1704x Fleet Polling //
+////////////////////////////
+// Polls up to N gauges, one snapshot per call to poll(), round-robin, so that
+// polling many gauges never blocks the loop for more than one transaction.
+// Each snapshot is kept and, optionally, fed into a SFE_MAX1704X_Pack.
+// Gauges behind an I2C mux can be added with the callback and channel used to
+// select them (see probeChannels).
+// Throughput and latency counters are maintained.
+template <uint8_t N>
+class SFE_MAX1704X_Fleet
+{
+public:
+  SFE_MAX1704X_Fleet(SFE_MAX1704X_Pack<N> *pack = NULL)
+  {
+    _pack = pack;
+    _numGauges = 0;
+    _next = 0;
+    resetCounters();
+  }
+
+  // Add a gauge. It becomes module number getNumGauges() - 1 in the pack.
+  // Output: true on success, false if the fleet is full.
+  boolean add(SFE_MAX1704X &gauge, sfe_max1704x_select_channel_t selectChannel = NULL, uint8_t channel = 0)
+  {
+    if (_numGauges >= N)
+      return (false);
+    _gauges[_numGauges] = &gauge;
+    _selectChannel[_numGauges] = selectChannel;
+    _channel[_numGauges] = channel;
+    _valid[_numGauges] = false;
+    _numGauges++;
+    return (true);
+  }
+
+  uint8_t getNumGauges() { return (_numGauges); }
+
+  // Poll the next gauge.
+  // Output: the index of the gauge which was polled successfully, or -1 if the
+  // read failed (or there are no gauges).
+  int16_t poll()
+  {
+    if (_numGauges == 0)
+      return (-1);
+
+    uint8_t index = _next;
+    _next = (_next + 1) % _numGauges;
+
+    unsigned long start = micros();
+    if (_selectChannel[index] != NULL)
+      _selectChannel[index](_channel[index]);
+    uint8_t result = _gauges[index]->getSnapshot(_snapshots[index]);
+    unsigned long elapsed = micros() - start;
+
+    _lastPollMicros = elapsed;
+    if (elapsed > _maxPollMicros)
+      _maxPollMicros = elapsed;
+    _totalPollMicros += elapsed;
+    _polls++;
+
+    if (result)
+    {
+      _valid[index] = false; // Keep the old snapshot, but no longer report it as current
+      if (_pack != NULL)
+        _pack->invalidate(index);
+      _failures++;
+      return (-1);
+    }
+
+    _valid[index] = true;
+    if (_pack != NULL)
+      _pack->update(index, _snapshots[index]);
+    return (index);
+  }
+
+  // Poll every gauge once, e.g. across several TwoWire buses, producing one
+  // consolidated set of snapshots for this cycle.
+  // TwoWire transfers block, so the buses are polled in turn: each gauge
+  // costs exactly one burst transaction.
+  // A gauge that fails to answer is marked invalid, and removed from the pack,
+  // until it is polled successfully again, so stale snapshots are never
+  // reported as current.
+  // Output: the number of gauges polled successfully.
+  uint8_t sweep()
+  {
+    unsigned long start = micros();
+    uint8_t good = 0;
+    _next = 0;
+    for (uint8_t i = 0; i < _numGauges; i++)
+      _valid[i] = false;
+    for (uint8_t i = 0; i < _numGauges; i++)
+    {
+      if (poll() >= 0)
+        good++;
+    }
+    _lastSweepMicros = micros() - start;
+    _sweeps++;
+    return (good);
+  }
+
+  // Time taken by the last sweep, and the number of sweeps since resetCounters()
+  unsigned long getLastSweepMicros() { return (_lastSweepMicros); }
+  uint32_t getSweeps() { return (_sweeps); }
+
+  // The most recent snapshot from gauge [index]
+  const sfe_max1704x_snapshot_t &getSnapshot(uint8_t index) { return (_snapshots[index]); }
+  // Did gauge [index] answer its most recent poll?
+  boolean isValid(uint8_t index) { return ((index < _numGauges) && _valid[index]); }
+
+  // Counters
+  void resetCounters()
+  {
+    _polls = 0;
+    _failures = 0;
+    _lastPollMicros = 0;
+    _maxPollMicros = 0;
+    _totalPollMicros = 0;
+    _countersStart = millis();
+    _lastSweepMicros = 0;
+    _sweeps = 0;
+  }
+  uint32_t getPolls() { return (_polls); }
+  uint32_t getFailures() { return (_failures); }
+  unsigned long getLastPollMicros() { return (_lastPollMicros); }
+  unsigned long getMaxPollMicros() { return (_maxPollMicros); }
+  unsigned long getMeanPollMicros() { return (_polls ? _totalPollMicros / _polls : 0); }
+  // Successful polls per second since resetCounters()
+  float getPollRate()
+  {
+    unsigned long elapsed = millis() - _countersStart;
+    return (elapsed ? ((float)(_polls - _failures) * 1000.0) / elapsed : 0.0);
+  }
+
+private:
+  SFE_MAX1704X *_gauges[N];
+  sfe_max1704x_select_channel_t _selectChannel[N];
+  uint8_t _channel[N];
+  sfe_max1704x_snapshot_t _snapshots[N];
+  boolean _valid[N];
+  uint8_t _numGauges;
+  uint8_t _next;
+  SFE_MAX1704X_Pack<N> *_pack;
+
+  uint32_t _polls;
+  uint32_t _failures;
+  unsigned long _lastPollMicros;
+  unsigned long _maxPollMicros;
+  unsigned long _totalPollMicros;
+  unsigned long _countersStart;
+  unsigned long _lastSweepMicros;
+  uint32_t _sweeps;
+};
+
+////////////////////////////////
+// MAX1704x Column Log Blocks //
+////////////////////////////////
+// SFE_MAX1704X_ColumnLog writes raw snapshots to a Print sink (e.g. an SD
+// card File) as a sequence of self-describing blocks. Each block is a header
+// followed by one column per field, all big-endian:
+//   Header (MAX1704X_LOG_HEADER_LENGTH bytes):
+//     0-1: MAX1704X_LOG_MAGIC   2: MAX1704X_LOG_VERSION   3: number of samples
+//     4-7: first timestamp   8-11: last timestamp
+//     12-15: VCELL min, max   16-19: SOC min, max   20-23: CRATE min, max
+//     24-25: STATUS, all samples ORed together
+//   Columns: timestamp (4 bytes per sample), then VCELL, SOC, CRATE and STATUS (2 bytes each)
+// A reader can answer time-range and threshold queries from the headers alone,
+// skipping getLength() bytes for every block which can not match.
+// Timestamps are whatever the caller passes to add(), e.g. RTC or epoch seconds.
+// Without one, snapshot.millis is used: it restarts at every reboot and wraps
+// after 49.7 days, so only use it for logs shorter than that and a single boot.
+#define MAX1704X_LOG_MAGIC 0x4D58 // "MX"
+#define MAX1704X_LOG_VERSION 1
+#define MAX1704X_LOG_HEADER_LENGTH 26 // Bytes
+#define MAX1704X_LOG_SAMPLE_LENGTH 12 // Column bytes per sample
+
+typedef struct
+{
+  uint8_t numSamples;
+  uint32_t firstTimestamp;
+  uint32_t lastTimestamp;
+  uint16_t minVcell;
+  uint16_t maxVcell;
+  uint16_t minSOC;
+  uint16_t maxSOC;
+  int16_t minCrate;
+  int16_t maxCrate;
+  uint16_t status; // All STATUS words ORed together
+} sfe_max1704x_log_header_t;
+
+class SFE_MAX1704X_LogBlock
+{
+public:
+  // writeHeader([header], [bytes]) - Encode [header] into MAX1704X_LOG_HEADER_LENGTH bytes
+  static void writeHeader(const sfe_max1704x_log_header_t &header, uint8_t *bytes);
+
+  // parseHeader([bytes], [length], [header]) - Decode a block header.
+  // Uses no Arduino functions, so it can be built into host-side readers.
+  // Output: 0 on success, positive integer if the header is short or not recognised.
+  static uint8_t parseHeader(const uint8_t *bytes, uint16_t length, sfe_max1704x_log_header_t &header);
+
+  // getLength([header]) - The length of the whole block, header included, in bytes
+  static uint16_t getLength(const sfe_max1704x_log_header_t &header);
+
+  // overlaps([header], [fromTimestamp], [toTimestamp]) - Could the block hold
+  // samples timestamped from [fromTimestamp] to [toTimestamp] inclusive?
+  // [fromTimestamp] must not be after [toTimestamp]. A block whose last
+  // timestamp is below its first has wrapped (or the clock was set back), so it
+  // is treated as covering everything from its first timestamp upwards and
+  // everything up to its last: it may match too often, but is never skipped wrongly.
+  static boolean overlaps(const sfe_max1704x_log_header_t &header, uint32_t fromTimestamp, uint32_t toTimestamp);
+};
+
+// Buffers N snapshots (N <= 255) and writes them as one block, e.g.:
+//   SFE_MAX1704X_ColumnLog<60> log(logFile);
+//   if (lipo.getSnapshot(snapshot) == 0)
+//     log.add(snapshot, rtcSeconds); // Writes a block every 60 snapshots
+//   ...
+//   log.flush(); // Write any partial block before closing the file
+// The buffer needs 12 bytes per sample.
+template <uint8_t N>
+class SFE_MAX1704X_ColumnLog
+{
+public:
+  SFE_MAX1704X_ColumnLog(Print &sink)
+  {
+    _sink = &sink;
+    _header.numSamples = 0;
+    _blocks = 0;
+    _bytes = 0;
+  }
+
+  // add([snapshot], [timestamp]) - Buffer [snapshot], writing the block when it is full.
+  // Input: [timestamp] - The time index for the sample, e.g. RTC or epoch seconds.
+  // Output: the number of bytes written to the sink (0 if the snapshot was only buffered).
+  size_t add(const sfe_max1704x_snapshot_t &snapshot, uint32_t timestamp)
+  {
+    uint8_t i = _header.numSamples;
+    if (i == 0)
+    {
+      _header.firstTimestamp = timestamp;
+      _header.minVcell = _header.maxVcell = snapshot.vcell;
+      _header.minSOC = _header.maxSOC = snapshot.soc;
+      _header.minCrate = _header.maxCrate = snapshot.crate;
+      _header.status = 0;
+    }
+    _header.lastTimestamp = timestamp;
+    if (snapshot.vcell < _header.minVcell) _header.minVcell = snapshot.vcell;
+    if (snapshot.vcell > _header.maxVcell) _header.maxVcell = snapshot.vcell;
+    if (snapshot.soc < _header.minSOC) _header.minSOC = snapshot.soc;
+    if (snapshot.soc > _header.maxSOC) _header.maxSOC = snapshot.soc;
+    if (snapshot.crate < _header.minCrate) _header.minCrate = snapshot.crate;
+    if (snapshot.crate > _header.maxCrate) _header.maxCrate = snapshot.crate;
+    _header.status |= snapshot.status;
+
+    _timestamps[i] = timestamp;
+    _vcell[i] = snapshot.vcell;
+    _soc[i] = snapshot.soc;
+    _crate[i] = (uint16_t)snapshot.crate;
+    _status[i] = snapshot.status;
+    _header.numSamples = i + 1;
+
+    if (_header.numSamples < N)
+      return (0);
+    return (flush());
+  }
+
+  // add([snapshot]) - As above, timestamped with snapshot.millis. See the wrap
+  // and reboot caveats above.
+  size_t add(const sfe_max1704x_snapshot_t &snapshot) { return (add(snapshot, snapshot.millis)); }
+
+  // flush() - Write the buffered samples as a (possibly partial) block.
+  // Output: the number of bytes written to the sink.
+  size_t flush()
+  {
+    if (_header.numSamples == 0)
+      return (0);
+
+    uint8_t buffer[MAX1704X_LOG_HEADER_LENGTH];
+    SFE_MAX1704X_LogBlock::writeHeader(_header, buffer);
+    size_t written = _sink->write(buffer, MAX1704X_LOG_HEADER_LENGTH);
+
+    // Write each column in header-sized chunks
+    uint8_t used = 0;
+    for (uint8_t i = 0; i < _header.numSamples; i++)
+    {
+      buffer[used++] = _timestamps[i] >> 24;
+      buffer[used++] = _timestamps[i] >> 16;
+      buffer[used++] = _timestamps[i] >> 8;
+      buffer[used++] = _timestamps[i];
+      if (used > (MAX1704X_LOG_HEADER_LENGTH - 4))
+      {
+        written += _sink->write(buffer, used);
+        used = 0;
+      }
+    }
+    const uint16_t *columns[4] = {_vcell, _soc, _crate, _status};
+    for (uint8_t c = 0; c < 4; c++)
+    {
+      for (uint8_t i = 0; i < _header.numSamples; i++)
+      {
+        buffer[used++] = columns[c][i] >> 8;
+        buffer[used++] = columns[c][i];
+        if (used > (MAX1704X_LOG_HEADER_LENGTH - 2))
+        {
+          written += _sink->write(buffer, used);
+          used = 0;
+        }
+      }
+    }
+    if (used > 0)
+      written += _sink->write(buffer, used);
+
+    _header.numSamples = 0;
+    _blocks++;
+    _bytes += written;
+    return (written);
+  }
+
+  uint8_t getNumBuffered() { return (_header.numSamples); } // Samples waiting to be written
+  uint32_t getBlocksWritten() { return (_blocks); }
+  uint32_t getBytesWritten() { return (_bytes); }
+
+private:
+  Print *_sink;
+  sfe_max1704x_log_header_t _header; // Summary of the buffered samples
+  uint32_t _timestamps[N];
+  uint16_t _vcell[N];
+  uint16_t _soc[N];
+  uint16_t _crate[N]; // int16_t CRATE, stored as raw words
+  uint16_t _status[N];
+  uint32_t _blocks;
+  uint32_t _bytes;
 };
 
 #endif